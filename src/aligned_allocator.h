@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace platz {
+
+	//! Allocator for standard containers whose storage starts on an alignment boundary,
+	//! e.g. a cache line for arrays read in SIMD batches
+	template <typename T, size_t alignment>
+	class AlignedAllocator {
+	public:
+
+		using value_type = T;
+
+		template <typename U>
+		struct rebind {
+			using other = AlignedAllocator<U, alignment>;
+		};
+
+		AlignedAllocator() = default;
+
+		template <typename U>
+		AlignedAllocator(const AlignedAllocator<U, alignment>&) {}
+
+		inline T* allocate(size_t count) {
+			return static_cast<T*>(operator new(count * sizeof(T), std::align_val_t(alignment)));
+		}
+
+		inline void deallocate(T* p, size_t count) {
+			operator delete(p, std::align_val_t(alignment));
+		}
+
+		template <typename U>
+		inline bool operator == (const AlignedAllocator<U, alignment>&) const { return true; }
+
+		template <typename U>
+		inline bool operator != (const AlignedAllocator<U, alignment>&) const { return false; }
+	};
+}
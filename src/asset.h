@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "job_system.h"
+
+namespace platz {
+
+	//! Base class for resources that can be loaded in the background by Assets
+	class Asset {
+		friend class Assets;
+
+	public:
+
+		virtual ~Asset() = default;
+
+		//! True once the asset data can be used. Never blocks.
+		inline bool ready() const { return _ready.load(std::memory_order_acquire); }
+
+		//! Blocks until the asset is loaded
+		void wait() const {
+			if (ready()) {
+				return;
+			}
+			if (auto loading = std::atomic_load(&_loading)) {
+				JobSystem::instance().wait(loading);
+			}
+		}
+
+	protected:
+
+		//! Publishes data written by the loading thread
+		inline void setReady(bool ready = true) { _ready.store(ready, std::memory_order_release); }
+
+	private:
+
+		//! Assets reloads evicted textures from the render thread while wait() can run on the main thread
+		inline void setLoading(const JobSystem::Handle& loading) { std::atomic_store(&_loading, loading); }
+
+		std::atomic<bool> _ready = { false };
+		JobSystem::Handle _loading;
+	};
+}
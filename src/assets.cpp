@@ -0,0 +1,220 @@
+
+#include "pch.h"
+#include "assets.h"
+#include "job_system.h"
+#include "texture.h"
+#include "mesh.h"
+#include "virtual_texture.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace platz {
+
+	std::unordered_map<std::string, std::weak_ptr<Texture>> Assets::_texturesByPath;
+	std::unordered_map<uint64_t, Assets::ContentEntry> Assets::_texturesByHash;
+	std::vector<std::weak_ptr<VirtualTexture>> Assets::_virtualTextures;
+	std::mutex Assets::_texturesMutex;
+	std::mutex Assets::_registryMutex;
+	size_t Assets::_textureBudget = (size_t)512 * 1024 * 1024;
+	size_t Assets::_textureMemory = 0;
+	uint64_t Assets::_frame = 1;
+
+	namespace assets {
+
+		//! FNV-1a of the file and the storage format, textures only share data when both match
+		uint64_t hash(const MappedFile& file, Texture::Format format) {
+			auto hash = 14695981039346656037ull;
+			for (size_t i = 0; i < file.size(); ++i) {
+				hash = (hash ^ (unsigned char)file.data()[i]) * 1099511628211ull;
+			}
+			return (hash ^ (uint64_t)format) * 1099511628211ull;
+		}
+
+		inline std::string key(const std::string& path, Texture::Format format) {
+			return format == Texture::Format::RGBA8 ? path : path + "#" + std::to_string((int)format);
+		}
+
+		//! Compares the bytes of two files, only called once their hashes and sizes match
+		bool sameContent(const MappedFile& file, const std::string& otherPath) {
+			MappedFile other(otherPath);
+			return other.valid()
+				&& other.size() == file.size()
+				&& memcmp(other.data(), file.data(), file.size()) == 0;
+		}
+	}
+
+	void Assets::decodeTexture(const std::shared_ptr<Texture>& texture) {
+		texture->_loadPending = true;
+		texture->setLoading(JobSystem::instance().submit([texture]() {
+			// The file is read once, for hashing and decoding
+			MappedFile file(texture->_path);
+			auto hash = assets::hash(file, texture->_format);
+			std::shared_ptr<Texture> twin;
+			{
+				std::lock_guard<std::mutex> lock(_texturesMutex);
+				auto twinIt = _texturesByHash.find(hash);
+				if (twinIt != _texturesByHash.end() && twinIt->second.fileSize == file.size()) {
+					twin = twinIt->second.texture.lock();
+				}
+			}
+			// Share the pixels of a resident texture with identical content.
+			// The files are compared outside of the lock, so that a hash collision cannot swap pixels.
+			if (twin && twin != texture && twin->_format == texture->_format && assets::sameContent(file, twin->_path)) {
+				std::lock_guard<std::mutex> lock(_texturesMutex);
+				if (twin->_data) {
+					texture->_hash = hash;
+					texture->width = twin->width;
+					texture->height = twin->height;
+					texture->_mips = twin->_mips;
+					texture->_data = twin->_data;
+					texture->setReady();
+					return;
+				}
+			}
+
+			int width = 0, height = 0;
+			auto data = Texture::decode(reinterpret_cast<const unsigned char*>(file.data()), file.size(), texture->_format, width, height);
+
+			std::lock_guard<std::mutex> lock(_texturesMutex);
+			texture->_hash = hash;
+			texture->width = width;
+			texture->height = height;
+			texture->_mips = Texture::mipChain(width, height, texture->_format);
+			texture->_data = data;
+			_texturesByHash[hash] = { texture, file.size() };
+			texture->setReady();
+		}, JobSystem::Priority::Background));
+	}
+
+	std::shared_ptr<Texture> Assets::loadTexture(const std::string& path, Texture::Format format) {
+		const auto key = assets::key(path, format);
+		std::lock_guard<std::mutex> lock(_registryMutex);
+		auto cached = _texturesByPath.find(key);
+		if (cached != _texturesByPath.end()) {
+			if (auto texture = cached->second.lock()) {
+				return texture;
+			}
+		}
+
+		std::shared_ptr<Texture> texture(new Texture());
+		texture->_path = path;
+		texture->_format = format;
+		_texturesByPath[key] = texture;
+		decodeTexture(texture);
+		return texture;
+	}
+
+	std::vector<std::shared_ptr<Texture>> Assets::loadTextures(const std::vector<std::string>& paths, Texture::Format format) {
+		std::vector<std::shared_ptr<Texture>> textures;
+		for (auto& path : paths) {
+			textures.push_back(loadTexture(path, format));
+		}
+		return textures;
+	}
+
+	std::shared_ptr<Mesh> Assets::loadMesh(const std::string& path) {
+		std::shared_ptr<Mesh> mesh(new Mesh());
+		mesh->setLoading(JobSystem::instance().submit([mesh, path]() {
+			mesh->load(path);
+		}, JobSystem::Priority::Background));
+		return mesh;
+	}
+
+	std::shared_ptr<VirtualTexture> Assets::loadVirtualTexture(const std::string& path, int cachePages) {
+		std::shared_ptr<VirtualTexture> texture(new VirtualTexture(cachePages));
+		texture->setLoading(JobSystem::instance().submit([texture, path]() {
+			texture->open(path);
+		}, JobSystem::Priority::Background));
+		std::lock_guard<std::mutex> lock(_registryMutex);
+		_virtualTextures.push_back(texture);
+		return texture;
+	}
+
+	void Assets::streamPages(const std::shared_ptr<VirtualTexture>& texture) {
+		texture->publish();
+		for (auto page : texture->requests()) {
+			auto slot = texture->allocate(page);
+			if (slot < 0) {
+				break;
+			}
+			JobSystem::instance().submit([texture, page, slot]() {
+				texture->load(page, slot);
+			}, JobSystem::Priority::Background);
+		}
+	}
+
+	void Assets::update() {
+		std::lock_guard<std::mutex> registryLock(_registryMutex);
+		std::vector<std::shared_ptr<Texture>> resident;
+		std::unordered_set<const unsigned char*> buffers;
+		_textureMemory = 0;
+
+		for (auto it = _texturesByPath.begin(); it != _texturesByPath.end();) {
+			auto texture = it->second.lock();
+			if (!texture) {
+				// No more users
+				it = _texturesByPath.erase(it);
+				continue;
+			}
+			++it;
+
+			if (!texture->ready()) {
+				if (!texture->_loadPending && texture->_lastUsedFrame == _frame) {
+					decodeTexture(texture);
+				}
+				continue;
+			}
+
+			texture->_loadPending = false;
+			if (texture->data()) {
+				// Pixels shared between textures are only counted once
+				if (buffers.insert(texture->data()).second) {
+					_textureMemory += texture->size();
+				}
+				resident.push_back(texture);
+			}
+		}
+
+		if (_textureMemory > _textureBudget) {
+			std::sort(resident.begin(), resident.end(), [](const std::shared_ptr<Texture>& a, const std::shared_ptr<Texture>& b) {
+				return a->_lastUsedFrame < b->_lastUsedFrame;
+			});
+
+			std::lock_guard<std::mutex> lock(_texturesMutex);
+			for (auto& texture : resident) {
+				if (_textureMemory <= _textureBudget || texture->_lastUsedFrame >= _frame) {
+					// Don't evict what is currently on screen
+					break;
+				}
+				if (texture->_data.use_count() == 1) {
+					_textureMemory -= texture->size();
+				}
+				texture->setReady(false);
+				texture->_data.reset();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_texturesMutex);
+			for (auto it = _texturesByHash.begin(); it != _texturesByHash.end();) {
+				it = it->second.texture.expired() ? _texturesByHash.erase(it) : std::next(it);
+			}
+		}
+
+		for (auto it = _virtualTextures.begin(); it != _virtualTextures.end();) {
+			auto texture = it->lock();
+			if (!texture) {
+				it = _virtualTextures.erase(it);
+				continue;
+			}
+			++it;
+			if (texture->ready() && texture->data()) {
+				streamPages(texture);
+			}
+		}
+
+		++_frame;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#include "texture_format.h"
+
+namespace platz {
+
+	class Texture;
+	class Mesh;
+	class VirtualTexture;
+
+	//! Loads assets with background jobs of the shared JobSystem.
+	//! Returned handles are usable immediately, check Asset::ready() before accessing their data.
+	//! Textures are shared by path and by content, and their decoded data is evicted
+	//! least-recently-used first when the texture budget is exceeded.
+	class Assets {
+
+		//! Decoded texture with a given content hash, and the size of its file
+		struct ContentEntry {
+			std::weak_ptr<Texture> texture;
+			size_t fileSize;
+		};
+
+		static std::unordered_map<std::string, std::weak_ptr<Texture>> _texturesByPath;
+		static std::unordered_map<uint64_t, ContentEntry> _texturesByHash;
+		static std::vector<std::weak_ptr<VirtualTexture>> _virtualTextures;
+		static std::mutex _texturesMutex;
+
+		//! Guards the asset lists, update() can run on the render thread while assets are loaded
+		static std::mutex _registryMutex;
+		static size_t _textureBudget;
+		static size_t _textureMemory;
+		static uint64_t _frame;
+
+		static void decodeTexture(const std::shared_ptr<Texture>& texture);
+		static void streamPages(const std::shared_ptr<VirtualTexture>& texture);
+
+	public:
+
+		//! The same file can be loaded in several formats, each is a separate texture
+		static std::shared_ptr<Texture> loadTexture(const std::string& path, TextureFormat format = TextureFormat::RGBA8);
+
+		//! Decodes the textures in parallel, one job each
+		static std::vector<std::shared_ptr<Texture>> loadTextures(const std::vector<std::string>& paths, TextureFormat format = TextureFormat::RGBA8);
+
+		static std::shared_ptr<Mesh> loadMesh(const std::string& path);
+
+		//! Opens a page file written by VirtualTexture::bake(), with a cache of cachePages pages
+		static std::shared_ptr<VirtualTexture> loadVirtualTexture(const std::string& path, int cachePages = 256);
+
+		//! Reloads evicted textures that were used last frame and enforces the texture budget.
+		//! Streams the virtual texture pages sampled this frame.
+		//! Must be called once per frame, outside of rendering.
+		static void update();
+
+		inline static uint64_t frame() { return _frame; }
+
+		//! Maximum size in bytes of decoded texture data
+		inline static size_t textureBudget() { return _textureBudget; }
+		inline static void textureBudget(size_t bytes) { _textureBudget = bytes; }
+
+		//! Size in bytes of decoded texture data as of the last update()
+		inline static size_t textureMemory() { return _textureMemory; }
+	};
+}
@@ -6,23 +6,230 @@
 #include "vector3.h"
 #include "plane.h"
 #include "clipping.h"
+#include "fast_math.h"
+#include "job_system.h"
 
 #include <assert.h>
+#include <limits>
 
 namespace platz {
 
-	Canvas::Canvas(int width, int height, int bpp /*= 3*/)
+	namespace canvas {
+
+		//! Depth test of DepthFormat::Float32, smaller normalized device depth is closer
+		struct Float32Depth {
+			using Type = float;
+			static constexpr Type cleared = 1.f;
+
+			//! Value stored for a pixel at ndcZ in [-1, 1], with inverseW the interpolated 1 / w
+			static inline Type encode(float ndcZ, float inverseW) { return ndcZ; }
+			static inline bool passes(Type depth, Type stored) { return depth <= stored; }
+		};
+
+		//! 1 / w is linear in screen space and greater when closer, so floats keep their precision far away
+		struct ReversedFloat32Depth {
+			using Type = float;
+			static constexpr Type cleared = 0.f;
+
+			static inline Type encode(float ndcZ, float inverseW) { return inverseW; }
+			static inline bool passes(Type depth, Type stored) { return depth >= stored; }
+		};
+
+		template <typename T, uint32_t max>
+		struct UnormDepth {
+			using Type = T;
+			static constexpr Type cleared = (Type)max;
+
+			static inline Type encode(float ndcZ, float inverseW) {
+				return (Type)(fastmath::saturate(ndcZ * .5f + .5f) * max + .5f);
+			}
+			static inline bool passes(Type depth, Type stored) { return depth <= stored; }
+		};
+
+		using Unorm24Depth = UnormDepth<uint32_t, 0xffffff>;
+		using Unorm16Depth = UnormDepth<uint16_t, 0xffff>;
+
+		int depthSize(DepthFormat format) {
+			return format == DepthFormat::Unorm16 ? sizeof(Unorm16Depth::Type) : sizeof(Float32Depth::Type);
+		}
+
+		template <typename Depth>
+		void clearDepth(unsigned char* depth, int index, int count) {
+			const auto values = reinterpret_cast<typename Depth::Type*>(depth) + index;
+			std::fill(values, values + count, Depth::cleared);
+		}
+
+		void clearDepth(DepthFormat format, unsigned char* depth, int index, int count) {
+			switch (format) {
+			case DepthFormat::Float32: clearDepth<Float32Depth>(depth, index, count); break;
+			case DepthFormat::ReversedFloat32: clearDepth<ReversedFloat32Depth>(depth, index, count); break;
+			case DepthFormat::Unorm24: clearDepth<Unorm24Depth>(depth, index, count); break;
+			case DepthFormat::Unorm16: clearDepth<Unorm16Depth>(depth, index, count); break;
+			}
+		}
+
+#ifdef PLATZ_FAST_MATH_SSE2
+		//! Saturates the channel of 4 pixels and scales it to [0, max], rounded to nearest
+		inline __m128i quantize(const float* channel, float max) {
+			return _mm_cvtps_epi32(_mm_mul_ps(fastmath::saturate(_mm_load_ps(channel)), _mm_set1_ps(max)));
+		}
+#else
+		inline uint32_t quantize(float channel, float max) {
+			return (uint32_t)std::lrint(fastmath::saturate(channel) * max);
+		}
+#endif
+
+		//! 8-bit channels with alpha 255, red and blue at the given bit offsets
+		template <int redShift, int blueShift>
+		void packBytes(const Color4& colors, uint32_t* out) {
+#ifdef PLATZ_FAST_MATH_SSE2
+			auto packed = _mm_or_si128(_mm_slli_epi32(quantize(colors.r, 255.f), redShift), _mm_slli_epi32(quantize(colors.g, 255.f), 8));
+			packed = _mm_or_si128(packed, _mm_slli_epi32(quantize(colors.b, 255.f), blueShift));
+			packed = _mm_or_si128(packed, _mm_set1_epi32((int)0xff000000));
+			_mm_store_si128(reinterpret_cast<__m128i*>(out), packed);
+#else
+			for (int i = 0; i < 4; ++i) {
+				out[i] = quantize(colors.r[i], 255.f) << redShift
+					| quantize(colors.g[i], 255.f) << 8
+					| quantize(colors.b[i], 255.f) << blueShift
+					| 0xff000000u;
+			}
+#endif
+		}
+
+		void pack565(const Color4& colors, uint32_t* out) {
+#ifdef PLATZ_FAST_MATH_SSE2
+			auto packed = _mm_or_si128(_mm_slli_epi32(quantize(colors.r, 31.f), 11), _mm_slli_epi32(quantize(colors.g, 63.f), 5));
+			packed = _mm_or_si128(packed, quantize(colors.b, 31.f));
+			_mm_store_si128(reinterpret_cast<__m128i*>(out), packed);
+#else
+			for (int i = 0; i < 4; ++i) {
+				out[i] = quantize(colors.r[i], 31.f) << 11 | quantize(colors.g[i], 63.f) << 5 | quantize(colors.b[i], 31.f);
+			}
+#endif
+		}
+
+		//! Writes the packed pixels of a quad in mask, pixel is the top-left one
+		template <typename T>
+		void storeQuad(const uint32_t* packed, int mask, unsigned char* pixel, int stride) {
+			for (int i = 0; i < 4; ++i) {
+				if (mask & (1 << i)) {
+					const auto value = (T)packed[i];
+					memcpy(pixel + (i >> 1) * stride + (i & 1) * sizeof(T), &value, sizeof(T));
+				}
+			}
+		}
+
+		//! Negative and NaN channels become 0, alpha is 1
+		void storeQuadFloat(const Color4& colors, int mask, unsigned char* pixel, int stride) {
+			const auto size = Canvas::pixelSize(PixelFormat::RGBA32F);
+#ifdef PLATZ_FAST_MATH_SSE2
+			// maxps returns the second operand for NaN
+			auto r = _mm_max_ps(_mm_load_ps(colors.r), _mm_setzero_ps());
+			auto g = _mm_max_ps(_mm_load_ps(colors.g), _mm_setzero_ps());
+			auto b = _mm_max_ps(_mm_load_ps(colors.b), _mm_setzero_ps());
+			auto a = _mm_set1_ps(1.f);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+			const __m128 pixels[4] = { r, g, b, a };
+			for (int i = 0; i < 4; ++i) {
+				if (mask & (1 << i)) {
+					_mm_storeu_ps(reinterpret_cast<float*>(pixel + (i >> 1) * stride + (i & 1) * size), pixels[i]);
+				}
+			}
+#else
+			for (int i = 0; i < 4; ++i) {
+				if (mask & (1 << i)) {
+					const float values[4] = {
+						colors.r[i] > 0.f ? colors.r[i] : 0.f,
+						colors.g[i] > 0.f ? colors.g[i] : 0.f,
+						colors.b[i] > 0.f ? colors.b[i] : 0.f,
+						1.f
+					};
+					memcpy(pixel + (i >> 1) * stride + (i & 1) * size, values, sizeof(values));
+				}
+			}
+#endif
+		}
+
+		//! Converts the shaded colors of a quad to the canvas format, 4 pixels at a time
+		void store(PixelFormat format, const Color4& colors, int mask, unsigned char* pixel, int stride) {
+			alignas(16) uint32_t packed[4];
+			switch (format) {
+			case PixelFormat::RGBA8:
+				packBytes<0, 16>(colors, packed);
+				storeQuad<uint32_t>(packed, mask, pixel, stride);
+				break;
+			case PixelFormat::BGRA8:
+				packBytes<16, 0>(colors, packed);
+				storeQuad<uint32_t>(packed, mask, pixel, stride);
+				break;
+			case PixelFormat::RGB565:
+				pack565(colors, packed);
+				storeQuad<uint16_t>(packed, mask, pixel, stride);
+				break;
+			case PixelFormat::RGBA32F:
+				storeQuadFloat(colors, mask, pixel, stride);
+				break;
+			}
+		}
+	}
+
+	Canvas::Canvas(
+		int width,
+		int height,
+		PixelFormat pixelFormat /*= PixelFormat::BGRA8*/,
+		DepthFormat depthFormat /*= DepthFormat::Float32*/
+	)
 		: _width(width)
 		, _height(height)
-		, _bpp(bpp) {
+		, _bpp(pixelSize(pixelFormat))
+		, _pixelFormat(pixelFormat)
+		, _depthFormat(depthFormat) {
 		onResize(width, height);
 	}
 
 	void Canvas::clear() {
-		const auto pixelCount = _width * _height;
-		const auto size = pixelCount * _bpp;
-		memset(_pixels, 0, size);
-		memcpy(_zbuffer, _emptyZbuffer, pixelCount * sizeof(float));
+		// Restart the counter before it wraps, so that no stale tile can match it
+		if (++_generation == 0) {
+			std::fill(_tileGenerations.begin(), _tileGenerations.end(), 0u);
+			_generation = 1;
+		}
+	}
+
+	void Canvas::resolve() {
+		// The depth of untouched tiles is left stale, it is cleared on first use in the next frames
+		for (int tileY = 0; tileY < _tilesY; ++tileY) {
+			for (int tileX = 0; tileX < _tilesX; ++tileX) {
+				if (_tileGenerations[tileY * _tilesX + tileX] != _generation) {
+					clearTile(tileX, tileY, false);
+				}
+			}
+		}
+	}
+
+	void Canvas::touch(int minX, int minY, int maxX, int maxY) {
+		for (auto tileY = minY / tileSize; tileY <= maxY / tileSize; ++tileY) {
+			for (auto tileX = minX / tileSize; tileX <= maxX / tileSize; ++tileX) {
+				auto& generation = _tileGenerations[tileY * _tilesX + tileX];
+				if (generation != _generation) {
+					clearTile(tileX, tileY, true);
+					generation = _generation;
+				}
+			}
+		}
+	}
+
+	void Canvas::clearTile(int tileX, int tileY, bool depth) {
+		const auto x = tileX * tileSize;
+		const auto width = std::min(_width - x, (int)tileSize);
+		const auto rowEnd = std::min((tileY + 1) * tileSize, _height);
+		for (auto y = tileY * tileSize; y < rowEnd; ++y) {
+			const auto index = y * _width + x;
+			memset(_pixels + (size_t)index * _bpp, 0, (size_t)width * _bpp);
+			if (depth) {
+				canvas::clearDepth(_depthFormat, _depth, index, width);
+			}
+		}
 	}
 
 	void Canvas::drawTriangle(
@@ -30,7 +237,84 @@ namespace platz {
 		const std::vector<Vertex>& vertices,
 		const zmath::Matrix44& projectionView,
 		Material* material
-	) {		
+	) {
+		rasterize(context, vertices.data(), projectionView, material, 0, _height);
+	}
+
+	void Canvas::drawTriangles(
+		JobSystem& jobs,
+		const ShadingContext& context,
+		const std::vector<Vertex>& vertices,
+		const zmath::Matrix44& projectionView,
+		Material* material
+	) {
+		const auto bandCount = (_height + bandHeight - 1) / bandHeight;
+		_bands.resize(bandCount);
+		for (auto& band : _bands) {
+			band.clear();
+		}
+
+		// Bin the triangles by the rows they cover, with the same mapping as rasterize()
+		for (int i = 0; i + 2 < (int)vertices.size(); i += 3) {
+			auto minY = std::numeric_limits<float>::max();
+			auto maxY = std::numeric_limits<float>::lowest();
+			for (int v = 0; v < 3; ++v) {
+				const auto clipSpace = projectionView * vertices[i + v].position;
+				const auto y = (-clipSpace.y / clipSpace.w + 1.f) / 2.f * _height;
+				minY = std::min(minY, y);
+				maxY = std::max(maxY, y);
+			}
+			const auto firstBand = std::max(0, std::min((int)std::floor(minY), _height - 1)) / bandHeight;
+			const auto lastBand = std::max(0, std::min((int)std::floor(maxY), _height - 1)) / bandHeight;
+			for (auto band = firstBand; band <= lastBand; ++band) {
+				_bands[band].push_back(i);
+			}
+		}
+
+		jobs.parallelFor(0, bandCount, 1, [&](int first, int last) {
+			for (auto band = first; band < last; ++band) {
+				const auto rowBegin = band * bandHeight;
+				for (auto triangle : _bands[band]) {
+					rasterize(context, &vertices[triangle], projectionView, material, rowBegin, rowBegin + bandHeight);
+				}
+			}
+		});
+	}
+
+	void Canvas::rasterize(
+		const ShadingContext& context,
+		const Vertex* vertices,
+		const zmath::Matrix44& projectionView,
+		Material* material,
+		int rowBegin,
+		int rowEnd
+	) {
+		// Dispatched once per triangle, so that the depth test inlines into the pixel loop
+		switch (_depthFormat) {
+		case DepthFormat::Float32:
+			rasterize<canvas::Float32Depth>(context, vertices, projectionView, material, rowBegin, rowEnd);
+			break;
+		case DepthFormat::ReversedFloat32:
+			rasterize<canvas::ReversedFloat32Depth>(context, vertices, projectionView, material, rowBegin, rowEnd);
+			break;
+		case DepthFormat::Unorm24:
+			rasterize<canvas::Unorm24Depth>(context, vertices, projectionView, material, rowBegin, rowEnd);
+			break;
+		case DepthFormat::Unorm16:
+			rasterize<canvas::Unorm16Depth>(context, vertices, projectionView, material, rowBegin, rowEnd);
+			break;
+		}
+	}
+
+	template <typename Depth>
+	void Canvas::rasterize(
+		const ShadingContext& context,
+		const Vertex* vertices,
+		const zmath::Matrix44& projectionView,
+		Material* material,
+		int rowBegin,
+		int rowEnd
+	) {
 
 		zmath::Vector4 clipSpace[3];
 		zmath::Vector3 ndc[3];
@@ -65,9 +349,14 @@ namespace platz {
 
 		// clip to screen space
 		auto minX = std::max(0, std::min((int)std::floor(fminX), _width - 1));
-		auto minY = std::max(0, std::min((int)std::floor(fminY), _height - 1));
+		auto minY = std::max(rowBegin, std::min((int)std::floor(fminY), _height - 1));
 		auto maxX = std::max(0, std::min((int)std::floor(fmaxX), _width - 1));
-		auto maxY = std::max(0, std::min((int)std::floor(fmaxY), _height - 1));
+		auto maxY = std::max(0, std::min((int)std::floor(fmaxY), std::min(_height, rowEnd) - 1));
+		if (minY > maxY) {
+			return;
+		}
+		// Bands are one row of tiles, so a tile is only cleared by the thread rasterizing its band
+		touch(minX, minY, maxX, maxY);
 
 		// calculate coordinates needed for perspective correct mapping
 		auto at = zmath::Vector3(vertices[0].uv, 1.f) / clipSpace[0].w;
@@ -82,6 +371,9 @@ namespace platz {
 		auto ac = zmath::Vector4(vertices[0].color.r, vertices[0].color.g, vertices[0].color.b, 1.f) / clipSpace[0].w;
 		auto bc = zmath::Vector4(vertices[1].color.r, vertices[1].color.g, vertices[1].color.b, 1.f) / clipSpace[1].w;
 		auto cc = zmath::Vector4(vertices[2].color.r, vertices[2].color.g, vertices[2].color.b, 1.f) / clipSpace[2].w;
+		auto al = zmath::Vector4(vertices[0].lighting, 1.f) / clipSpace[0].w;
+		auto bl = zmath::Vector4(vertices[1].lighting, 1.f) / clipSpace[1].w;
+		auto cl = zmath::Vector4(vertices[2].lighting, 1.f) / clipSpace[2].w;
 
 		// Rasterize
 		zmath::Vector3 coords;
@@ -91,80 +383,126 @@ namespace platz {
 			zmath::Vector3(screenSpace[2].x, screenSpace[2].y, 0.f)
 		);
 		
+		// Rasterize in 2x2 pixel quads, so texture coordinate derivatives can be taken between neighbours
 		const auto stride = _width * _bpp;
-		for (auto i = minY; i <= maxY; ++i) {			
-			for (auto j = minX; j <= maxX; ++j) {	
-				auto point = zmath::Vector3(.5f + j, .5f + i, 0);
-				if (triangle.getBarycentricCoords(point, coords) && triangle.containsCoords(coords)) {
-					const auto index = (i * _width) + j;
-					const auto newZ = coords.x * screenSpace[0].z + coords.y * screenSpace[1].z + coords.z * screenSpace[2].z;
-					const auto oldZ = _zbuffer[index];
-					if (newZ > oldZ) {
+		for (auto i = minY & ~1; i <= maxY; i += 2) {
+			for (auto j = minX & ~1; j <= maxX; j += 2) {
+
+				// Coordinates are extrapolated for every lane, including those past the canvas edge,
+				// they stay zero only if the triangle is degenerate
+				zmath::Vector3 quadCoords[4] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+				bool covered[4];
+				auto anyCovered = false;
+				for (int q = 0; q < 4; ++q) {
+					const auto x = j + (q & 1);
+					const auto y = i + (q >> 1);
+					auto point = zmath::Vector3(.5f + x, .5f + y, 0);
+					const auto valid = triangle.getBarycentricCoords(point, quadCoords[q]);
+					covered[q] = valid
+						&& x < _width
+						&& y < _height
+						&& triangle.containsCoords(quadCoords[q]);
+					anyCovered |= covered[q];
+				}
+
+				if (!anyCovered) {
+					continue;
+				}
+
+				// Perspective correct texture coordinates, including for pixels outside the triangle
+				zmath::Vector2 uvs[4] = { { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+				float inverseW[4];
+				for (int q = 0; q < 4; ++q) {
+					const auto& coords = quadCoords[q];
+					const auto wt = coords.x * at.z + coords.y * bt.z + coords.z * ct.z;
+					inverseW[q] = wt;
+					if (wt > 0.f) {
+						uvs[q] = zmath::Vector2(
+							(coords.x * at.x + coords.y * bt.x + coords.z * ct.x) / wt,
+							(coords.x * at.y + coords.y * bt.y + coords.z * ct.y) / wt
+						);
+					}
+				}
+
+				// Texture coordinates are set for all pixels so that materials can sample the whole quad
+				Fragments fragments;
+				fragments.mask = 0;
+				fragments.x = j;
+				fragments.y = i;
+				fragments.derivatives = {
+					uvs[1] - uvs[0],
+					uvs[2] - uvs[0]
+				};
+				for (int q = 0; q < 4; ++q) {
+					fragments.u[q] = uvs[q].x;
+					fragments.v[q] = uvs[q].y;
+					fragments.normalX[q] = 0.f;
+					fragments.normalY[q] = 0.f;
+					fragments.normalZ[q] = 0.f;
+				}
+
+				for (int q = 0; q < 4; ++q) {
+					if (!covered[q]) {
 						continue;
 					}
-					_zbuffer[index] = newZ;
 
-					const auto wt = coords.x * at.z + coords.y * bt.z + coords.z * ct.z;
-					zmath::Vector2 uv(
-						abs((coords.x * at.x + coords.y * bt.x + coords.z * ct.x) / wt),
-						abs((coords.x * at.y + coords.y * bt.y + coords.z * ct.y) / wt)
-					);					
+					const auto x = j + (q & 1);
+					const auto y = i + (q >> 1);
+					const auto& coords = quadCoords[q];
+					const auto index = (y * _width) + x;
+					const auto newZ = coords.x * screenSpace[0].z + coords.y * screenSpace[1].z + coords.z * screenSpace[2].z;
+					const auto depth = Depth::encode(newZ, inverseW[q]);
+					auto& stored = reinterpret_cast<typename Depth::Type*>(_depth)[index];
+					if (!Depth::passes(depth, stored)) {
+						continue;
+					}
+					stored = depth;
+					fragments.mask |= 1 << q;
 
 					const auto wp = coords.x * ap.w + coords.y * bp.w + coords.z * cp.w;
-					zmath::Vector4 position(
-						(coords.x * ap.x + coords.y * bp.x + coords.z * cp.x) / wp,
-						(coords.x * ap.y + coords.y * bp.y + coords.z * cp.y) / wp,
-						(coords.x * ap.z + coords.y * bp.z + coords.z * cp.z) / wp,
-						1.f
-					);
+					fragments.positionX[q] = (coords.x * ap.x + coords.y * bp.x + coords.z * cp.x) / wp;
+					fragments.positionY[q] = (coords.x * ap.y + coords.y * bp.y + coords.z * cp.y) / wp;
+					fragments.positionZ[q] = (coords.x * ap.z + coords.y * bp.z + coords.z * cp.z) / wp;
 
+					// Normalized for the whole quad below
 					const auto wn = coords.x * an.w + coords.y * bn.w + coords.z * cn.w;
-					zmath::Vector3 normal(
-						(coords.x * an.x + coords.y * bn.x + coords.z * cn.x) / wn,
-						(coords.x * an.y + coords.y * bn.y + coords.z * cn.y) / wn,
-						(coords.x * an.z + coords.y * bn.z + coords.z * cn.z) / wn
-					);
-
-					Color vertexColor(
-						(coords.x * ac.x + coords.y * bc.x + coords.z * cc.x) / wn,
-						(coords.x * ac.y + coords.y * bc.y + coords.z * cc.y) / wn,
-						(coords.x * ac.z + coords.y * bc.z + coords.z * cc.z) / wn
-					);
-
-					auto color = material->shade(
-						context,
-						{
-							position,
-							uv,
-							normal.normalized(),
-							vertexColor
-						}
-					);
-
-					// Draw pixel
-					auto pixelIndex = (i * stride) + j * _bpp;
-					_pixels[pixelIndex + 0] = (unsigned char)(color.r * 255.f);
-					_pixels[pixelIndex + 1] = (unsigned char)(color.g * 255.f);
-					_pixels[pixelIndex + 2] = (unsigned char)(color.b * 255.f);
+					fragments.normalX[q] = (coords.x * an.x + coords.y * bn.x + coords.z * cn.x) / wn;
+					fragments.normalY[q] = (coords.x * an.y + coords.y * bn.y + coords.z * cn.y) / wn;
+					fragments.normalZ[q] = (coords.x * an.z + coords.y * bn.z + coords.z * cn.z) / wn;
+
+					fragments.colorR[q] = (coords.x * ac.x + coords.y * bc.x + coords.z * cc.x) / wn;
+					fragments.colorG[q] = (coords.x * ac.y + coords.y * bc.y + coords.z * cc.y) / wn;
+					fragments.colorB[q] = (coords.x * ac.z + coords.y * bc.z + coords.z * cc.z) / wn;
+
+					if (context.vertexLighting) {
+						fragments.lightDiffuse[q] = (coords.x * al.x + coords.y * bl.x + coords.z * cl.x) / wn;
+						fragments.lightSpecular[q] = (coords.x * al.y + coords.y * bl.y + coords.z * cl.y) / wn;
+						fragments.lightAmbient[q] = (coords.x * al.z + coords.y * bl.z + coords.z * cl.z) / wn;
+					}
 				}
+
+				if (!fragments.mask) {
+					continue;
+				}
+				fastmath::normalize(fragments.normalX, fragments.normalY, fragments.normalZ);
+
+				Color4 colors;
+				material->shadeQuad(context, fragments, colors);
+				canvas::store(_pixelFormat, colors, fragments.mask, _pixels + (size_t)i * stride + (size_t)j * _bpp, stride);
 			}
 		}
 	}
 
 	void Canvas::drawPixel(int x, int y, const Color& color) {		
-		const auto stride = _width * _bpp;
-		const auto index = (y * stride) + x * _bpp;
-		_pixels[index + 0] = (unsigned char)(color.r * 255.f);
-		_pixels[index + 1] = (unsigned char)(color.g * 255.f);
-		_pixels[index + 2] = (unsigned char)(color.b * 255.f);
+		touch(x, y, x, y);
+		Color4 colors = {};
+		colors.set(0, color);
+		canvas::store(_pixelFormat, colors, 1, _pixels + ((size_t)y * _width + x) * _bpp, 0);
 	}
 
 	void Canvas::drawPixel(int x, int y, unsigned char r, unsigned char g, unsigned char b) {
-		const auto stride = _width * _bpp;
-		const auto index = (y * stride) + x * _bpp;
-		_pixels[index + 0] = r;
-		_pixels[index + 1] = g;
-		_pixels[index + 2] = b;
+		// Quantization rounds to nearest, so 8-bit formats get the bytes back exactly
+		drawPixel(x, y, Color(r / 255.f, g / 255.f, b / 255.f));
 	}
 
 	void Canvas::drawLine(float x0, float y0, float x1, float y1, const Color& color) {
@@ -205,17 +543,17 @@ namespace platz {
 
 		if (_pixels) {
 			delete[] _pixels;
-			delete[] _zbuffer;
-			delete[] _emptyZbuffer;
+			delete[] _depth;
 		}
 
 		const auto pixelCount = width * height;
 		_pixels = new unsigned char[(size_t)pixelCount * _bpp];
-		_zbuffer = new float[pixelCount];
-		_emptyZbuffer = new float[pixelCount];
-		for (int i = 0; i < pixelCount; ++i) {
-			_emptyZbuffer[i] = 1.0f;
-		}
+		_depth = new unsigned char[(size_t)pixelCount * canvas::depthSize(_depthFormat)];
+
+		// All tiles are stale until first drawn to
+		_tilesX = (width + tileSize - 1) / tileSize;
+		_tilesY = (height + tileSize - 1) / tileSize;
+		_tileGenerations.assign((size_t)_tilesX * _tilesY, 0u);
 	}
 }
 
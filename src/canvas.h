@@ -4,20 +4,32 @@
 #include "matrix44.h"
 #include "vertex.h"
 #include "shading_context.h"
+#include "depth_format.h"
+#include "pixel_format.h"
 
 namespace platz {
 
 	class Material;
 	class Light;
+	class JobSystem;
 
 	class Canvas {
 
 	public:
 
-		Canvas(int width, int height, int bpp = 3);
+		Canvas(
+			int width,
+			int height,
+			PixelFormat pixelFormat = PixelFormat::BGRA8,
+			DepthFormat depthFormat = DepthFormat::Float32
+		);
 
+		//! Starts a new frame. Tiles are cleared when first drawn to, see resolve().
 		void clear();
 
+		//! Fills the tiles that were not drawn to since clear(), must be called before reading pixels()
+		void resolve();
+
 		void drawTriangle(
 			const ShadingContext& context,
 			const std::vector<Vertex>& vertices,
@@ -25,6 +37,16 @@ namespace platz {
 			Material* material
 		);
 
+		//! Draws triangles of 3 consecutive world space vertices, in bands of rows rasterized in parallel.
+		//! Triangles are drawn in order within a band, so the result is the same as drawing them one by one.
+		void drawTriangles(
+			JobSystem& jobs,
+			const ShadingContext& context,
+			const std::vector<Vertex>& vertices,
+			const zmath::Matrix44& projectionView,
+			Material* material
+		);
+
 		void drawPixel(int x, int y, const Color& color);
 		void drawPixel(int x, int y, unsigned char r, unsigned char g, unsigned char b);
 		void drawLine(float x0, float y0, float x1, float y1, const Color& color);
@@ -35,15 +57,68 @@ namespace platz {
 		inline int width() const { return _width; }
 		inline int height() const { return _height; }
 		inline int bpp() const { return _bpp; }
+		inline PixelFormat pixelFormat() const { return _pixelFormat; }
+		inline DepthFormat depthFormat() const { return _depthFormat; }
 		inline unsigned char* pixels() const { return _pixels; }
 
+		//! Rows per band of drawTriangles(), even so that quads never straddle two bands
+		static const int bandHeight = 32;
+
+		//! Side of the square tiles cleared on first use, a band is one row of tiles
+		static const int tileSize = bandHeight;
+
+		static inline int pixelSize(PixelFormat format) {
+			switch (format) {
+			case PixelFormat::RGB565: return 2;
+			case PixelFormat::RGBA32F: return 16;
+			default: return 4;
+			}
+		}
+
 	private:
 
-		unsigned char* _pixels;
-		float* _zbuffer;
-		float* _emptyZbuffer;
+		//! Draws the rows of the triangle in [rowBegin, rowEnd), rowBegin must be even
+		void rasterize(
+			const ShadingContext& context,
+			const Vertex* vertices,
+			const zmath::Matrix44& projectionView,
+			Material* material,
+			int rowBegin,
+			int rowEnd
+		);
+
+		//! rasterize() for one depth format, see canvas::Float32Depth for the interface of Depth
+		template <typename Depth>
+		void rasterize(
+			const ShadingContext& context,
+			const Vertex* vertices,
+			const zmath::Matrix44& projectionView,
+			Material* material,
+			int rowBegin,
+			int rowEnd
+		);
+
+		//! Clears the tiles overlapping [minX, maxX] x [minY, maxY] that were not used since clear()
+		void touch(int minX, int minY, int maxX, int maxY);
+
+		void clearTile(int tileX, int tileY, bool depth);
+
+		unsigned char* _pixels = nullptr;
+		//! Values of _depthFormat, in its own type
+		unsigned char* _depth = nullptr;
 		int _width;
 		int _height;
 		int _bpp;
+		PixelFormat _pixelFormat;
+		DepthFormat _depthFormat;
+
+		//! Frame counter, a tile is cleared for the current frame if its generation matches
+		uint32_t _generation = 1;
+		std::vector<uint32_t> _tileGenerations;
+		int _tilesX = 0;
+		int _tilesY = 0;
+
+		//! Triangles overlapping each band, reused between draws
+		std::vector<std::vector<int>> _bands;
 	};
 }
@@ -36,5 +36,22 @@ namespace platz {
 			return Color(r + other.r, g + other.g, b + other.b, a + other.a);
 		}
 	};
+
+	//! 4 colors, one array per channel. Values are not clamped.
+	struct Color4 {
+		alignas(16) float r[4];
+		alignas(16) float g[4];
+		alignas(16) float b[4];
+		alignas(16) float a[4];
+
+		inline Color operator [] (int i) const { return Color(r[i], g[i], b[i], a[i]); }
+
+		inline void set(int i, const Color& color) {
+			r[i] = color.r;
+			g[i] = color.g;
+			b[i] = color.b;
+			a[i] = color.a;
+		}
+	};
 }
 
@@ -7,7 +7,8 @@ namespace platz {
 
 	class Component : public Object {
 		DECLARE_OBJECT(Component, Object);
-		friend class Entity;
+		friend class Components;
+		template <class T> friend class TypedComponentPool;
 
 	private:
 
@@ -17,8 +18,6 @@ namespace platz {
 
 		virtual ~Component() = default;
 
-		virtual void preUpdate() {}
-
 		inline Entity* entity() const { return _entity; }
 	};
 }
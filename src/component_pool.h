@@ -0,0 +1,165 @@
+#pragma once
+
+#include "component.h"
+
+#include <functional>
+#include <new>
+#include <vector>
+
+namespace platz {
+
+	//! Components of a single type, listed in dense slots.
+	//! A sparse array indexed by entity id maps each entity to its slot.
+	class ComponentPool {
+	public:
+
+		virtual ~ComponentPool() = default;
+
+		inline int size() const { return (int)_entities.size(); }
+
+		inline bool contains(int entity) const {
+			return entity < (int)_sparse.size() && _sparse[entity] >= 0;
+		}
+
+		//! Id of the entity owning the component in a slot
+		inline int entity(int slot) const { return _entities[slot]; }
+
+		//! Returns nullptr if the entity has no component in this pool
+		virtual Component* get(int entity) const = 0;
+
+		virtual void remove(int entity) = 0;
+
+	protected:
+
+		//! Slot of each entity id, -1 if it has no component here
+		std::vector<int> _sparse;
+
+		//! Entity id of each slot
+		std::vector<int> _entities;
+	};
+
+	//! Components are stored in fixed-size chunks and never move, so pointers to them stay valid until they are removed.
+	//! Storage freed by a removal is reused by the next component added. Removing a component only moves the
+	//! last slot of the dense lists into the freed one.
+	template <class T>
+	class TypedComponentPool : public ComponentPool {
+	public:
+
+		static const int chunkSize = 64;
+
+		using Callback = std::function<void(T*)>;
+
+		//! Called after a component is constructed and attached to its entity
+		std::vector<Callback> added;
+
+		//! Called before a component is destroyed
+		std::vector<Callback> removed;
+
+		//! Called by Components::changed()
+		std::vector<Callback> changed;
+
+		~TypedComponentPool() {
+			for (auto component : _components) {
+				component->~T();
+			}
+		}
+
+		inline T* at(int slot) const { return _components[slot]; }
+
+		inline T* component(int entity) const {
+			return contains(entity) ? at(_sparse[entity]) : nullptr;
+		}
+
+		//! Pointer to the component of each slot
+		inline const std::vector<T*>& components() const { return _components; }
+
+		//! Constructs the component of an entity in place, replacing any previous one
+		template <typename... Args>
+		T* add(Entity* owner, int entity, Args&&... args) {
+			if (contains(entity)) {
+				auto existing = at(_sparse[entity]);
+				notify(removed, existing);
+				existing->~T();
+				auto component = new (existing) T(std::forward<Args>(args)...);
+				component->_entity = owner;
+				notify(added, component);
+				return component;
+			}
+
+			int storage;
+			if (!_free.empty()) {
+				storage = _free.back();
+				_free.pop_back();
+			} else {
+				storage = _storageCount++;
+				if (storage / chunkSize >= (int)_chunks.size()) {
+					_chunks.push_back(std::unique_ptr<Chunk>(new Chunk));
+				}
+			}
+			auto component = new (storageAt(storage)) T(std::forward<Args>(args)...);
+			component->_entity = owner;
+			if (entity >= (int)_sparse.size()) {
+				_sparse.resize(entity + 1, -1);
+			}
+			_sparse[entity] = size();
+			_entities.push_back(entity);
+			_components.push_back(component);
+			_storage.push_back(storage);
+			notify(added, component);
+			return component;
+		}
+
+		virtual Component* get(int entity) const override {
+			return component(entity);
+		}
+
+		virtual void remove(int entity) override {
+			if (!contains(entity)) {
+				return;
+			}
+			const auto slot = _sparse[entity];
+			const auto last = size() - 1;
+			notify(removed, at(slot));
+			at(slot)->~T();
+			_free.push_back(_storage[slot]);
+			if (slot != last) {
+				_entities[slot] = _entities[last];
+				_components[slot] = _components[last];
+				_storage[slot] = _storage[last];
+				_sparse[_entities[slot]] = slot;
+			}
+			_entities.pop_back();
+			_components.pop_back();
+			_storage.pop_back();
+			_sparse[entity] = -1;
+		}
+
+		inline void notify(const std::vector<Callback>& callbacks, T* component) const {
+			for (auto& callback : callbacks) {
+				callback(component);
+			}
+		}
+
+	private:
+
+		struct Chunk {
+			alignas(T) unsigned char storage[sizeof(T) * chunkSize];
+		};
+
+		inline T* storageAt(int storage) const {
+			return reinterpret_cast<T*>(_chunks[storage / chunkSize]->storage) + storage % chunkSize;
+		}
+
+		std::vector<std::unique_ptr<Chunk>> _chunks;
+
+		//! Storage used so far, including freed storage
+		int _storageCount = 0;
+
+		//! Freed storage, reused last in first out while it is still in cache
+		std::vector<int> _free;
+
+		//! Component and storage index of each slot
+		std::vector<T*> _components;
+		std::vector<int> _storage;
+	};
+}
@@ -1,21 +1,96 @@
 #pragma once
 
-#include "component.h"
-#include "entities.h"
+#include "component_pool.h"
 
 namespace platz {
+
+	class Entity;
+
+	//! Owns the component pools, one per component type
 	class Components {
 
-		static std::unordered_map<int, std::vector<Component*>> _components;
+		static std::vector<std::unique_ptr<ComponentPool>> _pools;
+
+		template <class T>
+		static TypedComponentPool<T>& pool() {
+			if (T::TypeID >= (int)_pools.size()) {
+				_pools.resize(T::TypeID + 1);
+			}
+			auto& pool = _pools[T::TypeID];
+			if (!pool) {
+				pool = std::make_unique<TypedComponentPool<T>>();
+			}
+			return static_cast<TypedComponentPool<T>&>(*pool);
+		}
 
 	public:
+
+		//! Components of exactly type T, kept up to date as components are added and removed.
+		//! Removing a component changes the order, components themselves never move.
+		template <class T>
+		static const std::vector<T*>& ofType() {
+			return pool<T>().components();
+		}
+
+		//! Callbacks stay registered for the lifetime of the program.
+		//! A component keeps its address from its added to its removed callback, so pointers can key a journal.
+		template <class T>
+		static void onAdded(const std::function<void(T*)>& callback) {
+			pool<T>().added.push_back(callback);
+		}
+
+		//! Called while the component is still valid, other components are not affected by its removal
+		template <class T>
+		static void onRemoved(const std::function<void(T*)>& callback) {
+			pool<T>().removed.push_back(callback);
+		}
+
 		template <class T>
-		static std::vector<T*> ofType() {
-			auto components = _components[T::TypeID];
-			auto pointers = reinterpret_cast<T**>(components.data());
-			return std::vector<T*>(pointers, pointers + components.size());
+		static void onChanged(const std::function<void(T*)>& callback) {
+			pool<T>().changed.push_back(callback);
 		}
 
-		static void extract();
+		//! Called by components when their state changes, notifies the onChanged() callbacks
+		template <class T>
+		static void changed(T* component) {
+			auto& typed = pool<T>();
+			typed.notify(typed.changed, component);
+		}
+
+		template <class T, typename... Args>
+		static T* add(Entity* entity, int id, Args&&... args) {
+			return pool<T>().add(entity, id, std::forward<Args>(args)...);
+		}
+
+		template <class T>
+		static T* get(int entity) {
+			if (T::TypeID >= (int)_pools.size() || !_pools[T::TypeID]) {
+				return nullptr;
+			}
+			return static_cast<TypedComponentPool<T>&>(*_pools[T::TypeID]).component(entity);
+		}
+
+		static Component* get(int typeId, int entity) {
+			if (typeId >= (int)_pools.size() || !_pools[typeId]) {
+				return nullptr;
+			}
+			return _pools[typeId]->get(entity);
+		}
+
+		template <class T>
+		static void remove(int entity) {
+			if (T::TypeID < (int)_pools.size() && _pools[T::TypeID]) {
+				_pools[T::TypeID]->remove(entity);
+			}
+		}
+
+		//! Removes the components of all types from an entity
+		static void removeAll(int entity) {
+			for (auto& pool : _pools) {
+				if (pool) {
+					pool->remove(entity);
+				}
+			}
+		}
 	};
 }
@@ -0,0 +1,16 @@
+#pragma once
+
+namespace platz {
+
+	//! Storage format of a canvas depth buffer, chosen per canvas
+	enum class DepthFormat {
+		//! 32-bit float of the normalized device depth, smaller is closer
+		Float32,
+		//! 32-bit float of 1 / w, greater is closer. Precision stays even up to the far plane
+		ReversedFloat32,
+		//! 24-bit fixed point depth stored in 32 bits, compared as integers
+		Unorm24,
+		//! 16-bit fixed point depth, half the traffic but only suited to short depth ranges
+		Unorm16
+	};
+}
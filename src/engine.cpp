@@ -2,48 +2,115 @@
 #include "pch.h"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <limits>
 
 #include "engine.h"
 #include "canvas.h"
 #include "components.h"
+#include "entity.h"
 #include "visual.h"
 #include "camera.h"
 #include "transform.h"
+#include "transforms.h"
 #include "plane.h"
 #include "vertex.h"
+#include "vertexbuffer.h"
 #include "light.h"
+#include "shading_frame.h"
+#include "frame_packet.h"
+#include "framebuffer_upload.h"
+#include "assets.h"
+#include "job_system.h"
 
 #define GLT_IMPLEMENTATION
 #include "gltext.h"
 
 namespace platz {
 
+	namespace engine {
+
+		//! Largest side in pixels of the screen rectangle covering a vertex buffer,
+		//! infinite if its bounds cross the camera plane
+		float screenSize(const Vertexbuffer& vb, const Matrix44& modelViewProjection, int width, int height) {
+			auto minX = std::numeric_limits<float>::max();
+			auto minY = std::numeric_limits<float>::max();
+			auto maxX = std::numeric_limits<float>::lowest();
+			auto maxY = std::numeric_limits<float>::lowest();
+			for (int i = 0; i < 8; ++i) {
+				const auto corner = Vector3(
+					(i & 1) ? vb.boundsMax.x : vb.boundsMin.x,
+					(i & 2) ? vb.boundsMax.y : vb.boundsMin.y,
+					(i & 4) ? vb.boundsMax.z : vb.boundsMin.z
+				);
+				const auto clip = modelViewProjection * Vector4(corner, 1.f);
+				if (clip.w <= 0.f) {
+					return std::numeric_limits<float>::infinity();
+				}
+				const auto x = clip.x / clip.w * width / 2.f;
+				const auto y = clip.y / clip.w * height / 2.f;
+				minX = std::min(minX, x);
+				minY = std::min(minY, y);
+				maxX = std::max(maxX, x);
+				maxY = std::max(maxY, y);
+			}
+			return std::max(maxX - minX, maxY - minY);
+		}
+
+		//! The rasterizer's winding test done in world space, exact for a perspective camera at cameraPos.
+		//! Lets back faces skip clipping and vertex lighting.
+		inline bool backFacing(const Triangle& triangle, const Vector3& cameraPos) {
+			const auto normal = (triangle.points[1] - triangle.points[0]).cross(triangle.points[2] - triangle.points[0]);
+			return normal.dot(cameraPos - triangle.points[0]) < 0.f;
+		}
+	}
+
 	Engine* Engine::_instance = nullptr;
 
-	Engine::Engine(int width, int height, int downscale) {
+	Engine::Engine(int width, int height, int downscale, DepthFormat depthFormat, PixelFormat pixelFormat) {
 		_instance = this;
 		_downscale = downscale;
+		_depthFormat = depthFormat;
+		_pixelFormat = pixelFormat;
 		initCanvas(width, height);
 		initFullscreenQuad();
+		_shadingFrame = std::make_unique<ShadingFrame>();
+		_jobs = &JobSystem::instance();
 	}
 
 	void Engine::mainLoop() {
 		auto previousTime = (float)glfwGetTime();
-
-		Components::extract();
+		if (pipelined) {
+			startRenderThread();
+		}
 
 		while (!glfwWindowShouldClose(_window)) {
 
-			_canvas->clear();
+			if (!pipelined) {
+				_canvas->clear();
+			}
 
 			auto currentTime = (float)glfwGetTime();
 			_deltaTime = currentTime - previousTime;
 			previousTime = currentTime;
 
-			Components::extract();
 			onUpdate(_deltaTime);
 
-			render();			
+			// World matrices are final for the frame, rendering only reads them
+			Transforms::update();
+
+			auto packet = acquirePacket();
+			packet->capture(Components::ofType<Camera>(), Components::ofType<Visual>(), Components::ofType<Light>());
+
+			Canvas* presented = nullptr;
+			if (pipelined) {
+				submitPacket(std::move(packet));
+				presented = takeRenderedCanvas();
+			} else {
+				Assets::update();
+				render(*packet, *_canvas);
+				releasePacket(std::move(packet));
+				presented = _canvas;
+			}
 
 			//auto mvp = cameras[0]->projector->getProjectionMatrix() * cameras[0]->getViewMatrix();
 			//auto toScreen = [&](const Vector4& position) {
@@ -80,7 +147,14 @@ namespace platz {
 			glUseProgram(_shaderProgram);
 			glBindTexture(GL_TEXTURE_2D, _texture);
 			glBindVertexArray(0);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _canvas->width(), _canvas->height(), 0, GL_RGB, GL_UNSIGNED_BYTE, _canvas->pixels());
+			// Without a new frame from the render thread, the texture still holds the previous one
+			if (presented) {
+				_upload->upload(*presented);
+				if (pipelined) {
+					_canvas = presented;
+					releaseCanvas(presented);
+				}
+			}
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 			
 			gltBeginDraw();
@@ -90,23 +164,141 @@ namespace platz {
 			glfwSwapBuffers(_window);
 			glfwPollEvents();
 		}
+
+		if (pipelined) {
+			stopRenderThread();
+		}
 	}
 
-	void Engine::render() {
-		auto visuals = Components::ofType<Visual>();
-		auto cameras = Components::ofType<Camera>();
-		auto lights = Components::ofType<Light>();
-		for (auto camera : cameras) {
-			auto projectionView = camera->projector->getProjectionMatrix() * camera->getViewMatrix();
-			auto cameraTransform = camera->entity()->getComponent<Transform>();
-			auto cameraPos = cameraTransform->position();
-			auto frustum = camera->getFrustum();
-			for (auto visual : visuals) {
-
-				auto transform = visual->entity()->getComponent<Transform>();
-				auto vb = visual->geometry->getVertexBuffer();
-				auto material = visual->material.get();
+	void Engine::startRenderThread() {
+		// One canvas rendering, one waiting to be presented and one being uploaded
+		while (_canvases.size() < pipelineCanvasCount) {
+			_canvases.push_back(std::make_unique<Canvas>(_canvas->width(), _canvas->height(), _pixelFormat, _depthFormat));
+		}
+		_freeCanvases.clear();
+		for (auto& canvas : _canvases) {
+			_freeCanvases.push_back(canvas.get());
+		}
+		_renderedCanvas = nullptr;
+		_stopRendering = false;
+		_renderThread = std::thread(&Engine::renderLoop, this);
+	}
+
+	void Engine::stopRenderThread() {
+		{
+			std::lock_guard<std::mutex> lock(_pipelineMutex);
+			_stopRendering = true;
+		}
+		_pipelineCondition.notify_all();
+		_renderThread.join();
+	}
+
+	void Engine::renderLoop() {
+		while (true) {
+			std::unique_ptr<FramePacket> packet;
+			Canvas* canvas = nullptr;
+			{
+				std::unique_lock<std::mutex> lock(_pipelineMutex);
+				_pipelineCondition.wait(lock, [this]() { return _stopRendering || (_pendingPacket && !_freeCanvases.empty()); });
+				if (_stopRendering) {
+					return;
+				}
+				packet = std::move(_pendingPacket);
+				canvas = _freeCanvases.back();
+				_freeCanvases.pop_back();
+				_rendering = true;
+			}
+			// The main thread can submit the next frame while this one renders
+			_pipelineCondition.notify_all();
+
+			// Texture eviction must not happen while a frame samples them, so assets update on this side
+			Assets::update();
+			canvas->clear();
+			render(*packet, *canvas);
+
+			{
+				std::lock_guard<std::mutex> lock(_pipelineMutex);
+				// A frame that was never presented is dropped for the newer one
+				if (_renderedCanvas) {
+					_freeCanvases.push_back(_renderedCanvas);
+				}
+				_renderedCanvas = canvas;
+				_rendering = false;
+			}
+			releasePacket(std::move(packet));
+			_pipelineCondition.notify_all();
+		}
+	}
 
+	std::unique_ptr<FramePacket> Engine::acquirePacket() {
+		std::lock_guard<std::mutex> lock(_pipelineMutex);
+		if (_freePackets.empty()) {
+			return std::make_unique<FramePacket>();
+		}
+		auto packet = std::move(_freePackets.back());
+		_freePackets.pop_back();
+		return packet;
+	}
+
+	void Engine::releasePacket(std::unique_ptr<FramePacket> packet) {
+		std::lock_guard<std::mutex> lock(_pipelineMutex);
+		_freePackets.push_back(std::move(packet));
+	}
+
+	void Engine::submitPacket(std::unique_ptr<FramePacket> packet) {
+		std::unique_lock<std::mutex> lock(_pipelineMutex);
+		// The simulation runs at most one frame ahead of rendering
+		_pipelineCondition.wait(lock, [this]() { return !_pendingPacket; });
+		_pendingPacket = std::move(packet);
+		lock.unlock();
+		_pipelineCondition.notify_all();
+	}
+
+	Canvas* Engine::takeRenderedCanvas() {
+		std::lock_guard<std::mutex> lock(_pipelineMutex);
+		auto canvas = _renderedCanvas;
+		_renderedCanvas = nullptr;
+		return canvas;
+	}
+
+	void Engine::releaseCanvas(Canvas* canvas) {
+		{
+			std::lock_guard<std::mutex> lock(_pipelineMutex);
+			_freeCanvases.push_back(canvas);
+		}
+		_pipelineCondition.notify_all();
+	}
+
+	void Engine::waitForRenderer() {
+		std::unique_lock<std::mutex> lock(_pipelineMutex);
+		_pipelineCondition.wait(lock, [this]() { return !_pendingPacket && !_rendering; });
+	}
+
+	void Engine::render(const FramePacket& packet, Canvas& canvas) {
+		for (auto& view : packet.views) {
+			auto& frustum = view.frustum;
+			_shadingFrame->build(packet, view, canvas.width(), canvas.height());
+			auto& projectionView = _shadingFrame->projectionView;
+			for (auto& draw : packet.draws) {
+
+				auto vb = draw.vertexbuffer;
+				auto& worldMatrix = draw.worldMatrix;
+				auto material = draw.material.get();
+				const auto vertexLighting = material->supportsVertexLighting() && (
+					material->vertexLighting
+					|| (draw.vertexLightingSize > 0.f
+						&& engine::screenSize(*vb, projectionView * worldMatrix, canvas.width(), canvas.height()) < draw.vertexLightingSize)
+				);
+				const ShadingContext context = {
+					*_shadingFrame,
+					draw.receiveShadows,
+					vertexLighting
+				};
+				material->prepare(context);
+
+				// Triangles are clipped and lit here, then rasterized in parallel once the draw is complete
+				_drawVertices.clear();
+				_drawLighting.clear();
 				for (size_t i = 0; i < vb->vertices.size(); i += 3) {
 					Vertex vertices[3] = {
 						vb->vertices[i],
@@ -116,76 +308,80 @@ namespace platz {
 
 					// clipping
 					Triangle triangle(
-						transform->worldMatrix() * vertices[0].position.xyz,
-						transform->worldMatrix() * vertices[1].position.xyz,
-						transform->worldMatrix() * vertices[2].position.xyz
+						worldMatrix * vertices[0].position.xyz,
+						worldMatrix * vertices[1].position.xyz,
+						worldMatrix * vertices[2].position.xyz
 					);
+					if (engine::backFacing(triangle, _shadingFrame->cameraPos)) {
+						continue;
+					}
 					std::vector<zmath::Clipping::ClippedTriangle> clippedTriangles;
 					auto status = frustum.clip(triangle, clippedTriangles);					
 
 					auto makeVertex = [&](const Clipping::ClippedVertex& vertex) -> Vertex {
 						if (vertex.index >= 0) {
-							return {
+							Vertex result(
 								Vector4(triangle.points[vertex.index], 1.f),
 								vertices[vertex.index].uv,
 								vertices[vertex.index].normal,
-								vertices[vertex.index].color,
-							};
+								vertices[vertex.index].color
+							);
+							result.lighting = vertices[vertex.index].lighting;
+							return result;
 						} else {
-							return {
+							Vertex result(
 								Vector4(vertex.clippedPosition, 1.f),
 								vertices[vertex.mixVertex2].uv * vertex.mixFactor + vertices[vertex.mixVertex1].uv * (1.f - vertex.mixFactor),
 								vertices[vertex.mixVertex2].normal * vertex.mixFactor + vertices[vertex.mixVertex1].normal * (1.f - vertex.mixFactor),
-								vertices[vertex.mixVertex2].color * vertex.mixFactor + vertices[vertex.mixVertex1].color * (1.f - vertex.mixFactor),
-							};
+								vertices[vertex.mixVertex2].color * vertex.mixFactor + vertices[vertex.mixVertex1].color * (1.f - vertex.mixFactor)
+							);
+							result.lighting = vertices[vertex.mixVertex2].lighting * vertex.mixFactor + vertices[vertex.mixVertex1].lighting * (1.f - vertex.mixFactor);
+							return result;
 						}
 					};
 
 					if (status == Clipping::Status::Hidden) {
 						continue;
-					} else if (status == Clipping::Status::Visible) {
-
-						std::vector<Vertex> worldVertices = {
-							makeVertex({ 0, Vector3::zero, 0.f, 0, 0 }),
-							makeVertex({ 1, Vector3::zero, 0.f, 0, 0 }),
-							makeVertex({ 2, Vector3::zero, 0.f, 0, 0 })
-						};
-						_canvas->drawTriangle(
-							{
-								cameraPos,
-								visuals,
-								lights,
-								visual->receiveShadows
-							},
-							worldVertices,
-							projectionView,
-							material
-						);						
+					}
+
+					if (vertexLighting) {
+						for (int v = 0; v < 3; ++v) {
+							auto& source = vb->vertices[i + v];
+							const LightingKey key = { {
+								source.position.x, source.position.y, source.position.z,
+								source.normal.x, source.normal.y, source.normal.z
+							} };
+							auto lit = _drawLighting.emplace(key, Vector3::zero);
+							if (lit.second) {
+								vertices[v].position = Vector4(triangle.points[v], 1.f);
+								material->lightVertex(context, vertices[v]);
+								lit.first->second = vertices[v].lighting;
+							} else {
+								vertices[v].lighting = lit.first->second;
+							}
+						}
+					}
+
+					if (status == Clipping::Status::Visible) {
+
+						_drawVertices.push_back(makeVertex({ 0, Vector3::zero, 0.f, 0, 0 }));
+						_drawVertices.push_back(makeVertex({ 1, Vector3::zero, 0.f, 0, 0 }));
+						_drawVertices.push_back(makeVertex({ 2, Vector3::zero, 0.f, 0, 0 }));
 
 					} else {
 
 						for (auto& clippedTriangle : clippedTriangles) {
-							std::vector<Vertex> worldVertices = {
-								makeVertex(clippedTriangle.vertices[0]),
-								makeVertex(clippedTriangle.vertices[1]),
-								makeVertex(clippedTriangle.vertices[2])
-							};
-							_canvas->drawTriangle(
-								{
-									cameraPos,
-									visuals,
-									lights,
-									visual->receiveShadows
-								},
-								worldVertices,
-								projectionView,
-								material
-							);
+							_drawVertices.push_back(makeVertex(clippedTriangle.vertices[0]));
+							_drawVertices.push_back(makeVertex(clippedTriangle.vertices[1]));
+							_drawVertices.push_back(makeVertex(clippedTriangle.vertices[2]));
 						}
 					}
 				}
+
+				canvas.drawTriangles(jobs(), context, _drawVertices, projectionView, material);
 			}
 		}
+		canvas.resolve();
 	}
 
 	void Engine::close() {
@@ -194,12 +390,24 @@ namespace platz {
 
 	Engine::~Engine() {
 		_instance = nullptr;
+		// Buffers are released while the context still exists
+		_upload.reset();
 		glfwTerminate();
 	}
 
 	void Engine::onResize(int width, int height) {
 		glViewport(0, 0, width, height);
-		_canvas->onResize(width, height);
+		if (_renderThread.joinable()) {
+			waitForRenderer();
+			// The rendered frame has the old size
+			if (auto canvas = takeRenderedCanvas()) {
+				releaseCanvas(canvas);
+			}
+		}
+		for (auto& canvas : _canvases) {
+			canvas->onResize(width, height);
+		}
+		_upload->resize(_texture, _canvas->width(), _canvas->height(), _pixelFormat);
 	}
 
 	void Engine::initCanvas(int width, int height) {
@@ -285,7 +493,8 @@ namespace platz {
 
 		int canvasWidth, canvasHeight;
 		glfwGetFramebufferSize(_window, &canvasWidth, &canvasHeight);
-		_canvas = std::make_unique<Canvas>(canvasWidth / _downscale, canvasHeight / _downscale);
+		_canvases.push_back(std::make_unique<Canvas>(canvasWidth / _downscale, canvasHeight / _downscale, _pixelFormat, _depthFormat));
+		_canvas = _canvases.front().get();
 	}
 
 	void Engine::initFullscreenQuad() {
@@ -383,8 +592,8 @@ namespace platz {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _canvas->width(), _canvas->height(), 0, GL_RGB, GL_UNSIGNED_BYTE, _canvas->pixels());
+		_upload = std::make_unique<FramebufferUpload>();
+		_upload->resize(_texture, _canvas->width(), _canvas->height(), _pixelFormat);
 		const auto pixelsLocation = glGetUniformLocation(_shaderProgram, "pixels");
 		glUniform1i(pixelsLocation, 0);
 	}
@@ -1,28 +1,58 @@
 #pragma once
 
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include "mouse_input.h"
+#include "vertex.h"
+#include "depth_format.h"
+#include "pixel_format.h"
 
 struct GLFWwindow;
 
 namespace platz {
 
 	class Canvas;	
+	class ShadingFrame;
+	class JobSystem;
+	struct FramePacket;
+	class FramebufferUpload;
 
 	class Engine {
 	public:
 
 		inline static Engine* instance() { return _instance; }
 
-		Engine(int width, int height, int downscale = 1);
+		//! The canvases are width / downscale by height / downscale, in pixelFormat and depthFormat
+		Engine(
+			int width,
+			int height,
+			int downscale = 1,
+			DepthFormat depthFormat = DepthFormat::Float32,
+			PixelFormat pixelFormat = PixelFormat::BGRA8
+		);
 		~Engine();
 
 		void mainLoop();
 		void close();
 
-		inline Canvas* canvas() const { return _canvas.get(); }
+		//! While pipelined, the canvas last presented, which the render thread may already be drawing to again
+		inline Canvas* canvas() const { return _canvas; }
 		inline float deltaTime() const { return _deltaTime; }
 
+		//! Scheduler running the render stages, shared with the asset loaders and usable from onUpdate.
+		//! Configure it with JobSystem::configure() before creating the engine.
+		inline JobSystem& jobs() const { return *_jobs; }
+
+		//! Renders each frame on a render thread while the main thread simulates the next one.
+		//! Frames are then presented one frame later. Set before mainLoop().
+		//! Geometry and materials must not be modified from onUpdate while pipelined, see FramePacket.
+		bool pipelined = false;
+
 		std::function<void(float)> onUpdate = [](float f) {};
 
 		std::function<void(int, int)> onKeyChanged;
@@ -34,7 +64,28 @@ namespace platz {
 
 		static Engine* _instance;
 
-		void render();
+		//! Canvases rendered, waiting for presentation and being presented
+		static const size_t pipelineCanvasCount = 3;
+
+		//! Draws the packet to the canvas and resolves it, the canvas is ready for upload after
+		void render(const FramePacket& packet, Canvas& canvas);
+
+		void startRenderThread();
+		void stopRenderThread();
+		void renderLoop();
+
+		std::unique_ptr<FramePacket> acquirePacket();
+		void releasePacket(std::unique_ptr<FramePacket> packet);
+
+		//! Blocks while the render thread has not taken the previous packet
+		void submitPacket(std::unique_ptr<FramePacket> packet);
+
+		//! Returns the newest frame the render thread completed, nullptr if there is none since the last call
+		Canvas* takeRenderedCanvas();
+		void releaseCanvas(Canvas* canvas);
+
+		//! Blocks until the render thread is idle
+		void waitForRenderer();
 		void onResize(int width, int height);
 
 		void initCanvas(int width, int height);
@@ -43,9 +94,54 @@ namespace platz {
 		GLFWwindow* _window = nullptr;
 		float _deltaTime = 0.f;
 		int _downscale;
+		DepthFormat _depthFormat;
+		PixelFormat _pixelFormat;
 		unsigned int _texture;
 		unsigned int _shaderProgram;
-		std::unique_ptr<Canvas> _canvas;
+		std::unique_ptr<FramebufferUpload> _upload;
+		std::vector<std::unique_ptr<Canvas>> _canvases;
+
+		//! Last presented canvas
+		Canvas* _canvas = nullptr;
+		std::unique_ptr<ShadingFrame> _shadingFrame;
+		JobSystem* _jobs = nullptr;
+
+		//! World space vertices of the current draw, 3 per triangle
+		std::vector<Vertex> _drawVertices;
+
+		//! Vertex buffers list every triangle corner, so shared vertices are lit once per draw
+		//! by keying their light terms on the local position and normal, compared bitwise
+		struct LightingKey {
+			float values[6];
+
+			inline bool operator==(const LightingKey& other) const {
+				return memcmp(values, other.values, sizeof(values)) == 0;
+			}
+		};
+
+		struct LightingKeyHash {
+			size_t operator()(const LightingKey& key) const {
+				uint32_t bits[6];
+				memcpy(bits, key.values, sizeof(bits));
+				uint64_t hash = 14695981039346656037ull;
+				for (auto word : bits) {
+					hash = (hash ^ word) * 1099511628211ull;
+				}
+				return (size_t)hash;
+			}
+		};
+
+		std::unordered_map<LightingKey, zmath::Vector3, LightingKeyHash> _drawLighting;
+
+		std::thread _renderThread;
+		std::mutex _pipelineMutex;
+		std::condition_variable _pipelineCondition;
+		std::unique_ptr<FramePacket> _pendingPacket;
+		std::vector<std::unique_ptr<FramePacket>> _freePackets;
+		std::vector<Canvas*> _freeCanvases;
+		Canvas* _renderedCanvas = nullptr;
+		bool _rendering = false;
+		bool _stopRendering = false;
 		MouseInput _mouseInput;
 	};
 }
@@ -3,13 +3,36 @@
 
 #include "entities.h"
 
+#include <new>
+
 namespace platz {
-	std::unordered_map<int, std::unique_ptr<Entity>> Entities::_entities;
+	std::vector<std::unique_ptr<Entities::Chunk>> Entities::_chunks;
+	int Entities::_slotCount = 0;
+	std::vector<int> Entities::_free;
 
 	Entity* Entities::create() {
-		auto size = (int)_entities.size();
-		auto entity = new Entity();
-		_entities.insert({ size, std::unique_ptr<Entity>(entity) });
-		return entity;
+		if (!_free.empty()) {
+			auto entity = slot(_free.back());
+			_free.pop_back();
+			entity->_alive = true;
+			return entity;
+		}
+
+		const auto id = _slotCount++;
+		if (id / chunkSize >= (int)_chunks.size()) {
+			_chunks.push_back(std::unique_ptr<Chunk>(new Chunk));
+		}
+		// Slots are never destructed, entities hold no resources
+		return new (slot(id)) Entity(id);
+	}
+
+	void Entities::destroy(Entity* entity) {
+		if (!entity || !entity->_alive) {
+			return;
+		}
+		Components::removeAll(entity->_id);
+		entity->_alive = false;
+		++entity->_generation;
+		_free.push_back(entity->_id);
 	}
 }
@@ -3,13 +3,53 @@
 #include "entity.h"
 
 namespace platz {
+
+	//! Entities live in fixed-size chunks and the ids of destroyed entities are reused,
+	//! so spawning and despawning does not allocate once the peak entity count was reached.
 	class Entities {
 
-		friend class Components;
-		static std::unordered_map<int, std::unique_ptr<Entity>> _entities;
+		static const int chunkSize = 256;
+
+		struct Chunk {
+			alignas(Entity) unsigned char storage[sizeof(Entity) * chunkSize];
+		};
+
+		static std::vector<std::unique_ptr<Chunk>> _chunks;
+
+		//! Slots constructed so far, indexed by entity id
+		static int _slotCount;
+
+		//! Ids of destroyed entities, reused last in first out
+		static std::vector<int> _free;
+
+		inline static Entity* slot(int id) {
+			return reinterpret_cast<Entity*>(_chunks[id / chunkSize]->storage) + id % chunkSize;
+		}
 
 	public:
 
 		static Entity* create();
+
+		//! Removes the components of the entity and frees its id.
+		//! Existing pointers will refer to the next entity created with this id, keep a handle to detect it.
+		static void destroy(Entity* entity);
+
+		inline static void destroy(EntityHandle handle) {
+			if (auto entity = get(handle)) {
+				destroy(entity);
+			}
+		}
+
+		//! Returns nullptr if the entity was destroyed
+		inline static Entity* get(EntityHandle handle) {
+			if (handle.id < 0 || handle.id >= _slotCount) {
+				return nullptr;
+			}
+			auto entity = slot(handle.id);
+			return entity->_alive && entity->_generation == handle.generation ? entity : nullptr;
+		}
+
+		//! Entities alive
+		inline static int count() { return _slotCount - (int)_free.size(); }
 	};
 }
@@ -1,56 +1,76 @@
 #pragma once
 
+#include <assert.h>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
-#include "component.h"
-
-#include <unordered_map>
-
 #include "object.h"
 #include "component.h"
+#include "components.h"
 
 namespace platz {	
 
+	//! Refers to an entity by id and generation.
+	//! Stale once the entity is destroyed, even after its id is reused, see Entities::get().
+	struct EntityHandle {
+		int id = -1;
+		uint32_t generation = 0;
+
+		inline bool operator == (const EntityHandle& other) const { return id == other.id && generation == other.generation; }
+		inline bool operator != (const EntityHandle& other) const { return !(*this == other); }
+	};
+
+	//! An id indexing the component pools
 	class Entity : public Object {
 
 		DECLARE_OBJECT(Entity, Object);
 		friend class Entities;
-		friend class Components;
 
 	private:
 
-		std::unordered_map<int, std::shared_ptr<Component>> _components;
+		int _id;
 
-		Entity() = default;
+		//! Incremented when the entity is destroyed
+		uint32_t _generation = 0;
+		bool _alive = true;
+
+		Entity(int id)
+			: _id(id) {
+		}
 
 	public:
 
+		inline int id() const { return _id; }
+		inline EntityHandle handle() const { return { _id, _generation }; }
+		inline bool alive() const { return _alive; }
+
+		//! Ignored on a destroyed entity, the next entity created with its id would inherit the component
 		template <typename T, typename... Args>
 		Entity* setComponent(Args&&... args) {
-			const auto component = std::make_shared<T>(std::forward<Args>(args)...);
-			component.get()->_entity = this;
-			_components[T::TypeID] = component;
+			assert(_alive);
+			if (_alive) {
+				Components::add<T>(this, _id, std::forward<Args>(args)...);
+			}
 			return this;
 		}
 
 		template <typename T>
 		T* getComponent() const {
-			return static_cast<T*>(getComponentByTypeId(T::TypeID));
+			return Components::get<T>(_id);
 		}
 
 		Component* getComponentByTypeId(int typeId) const {
-			try {
-				return _components.at(typeId).get();
-			} catch (const std::exception& e) {
-				(void)e;
-				return nullptr;
-			}
+			return Components::get(typeId, _id);
 		}
 
+		//! Ignored on a destroyed entity, its id may already belong to a new one
 		template <typename T>
 		void clearComponent() {
-			_components.erase(T::TypeID);
+			assert(_alive);
+			if (_alive) {
+				Components::remove<T>(_id);
+			}
 		}
 	};
 }
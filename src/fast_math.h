@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define PLATZ_FAST_MATH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace platz {
+
+	//! Approximations of the math functions used while shading, with bounded error.
+	//! Batched versions work on 4 lanes, the pixels of a quad, and take 16-byte aligned arrays.
+	//! Input and output arrays can be the same.
+	namespace fastmath {
+
+		//! Coefficients of 2 / (k ln 2), for the odd series of log2((1 + t) / (1 - t))
+		const float log2C1 = 2.885390082f;
+		const float log2C3 = .961796694f;
+		const float log2C5 = .577078016f;
+		const float log2C7 = .412198583f;
+		const float log2C9 = .320598898f;
+
+		const float ln2 = .693147181f;
+		const float sqrt2 = 1.414213562f;
+
+		//! Exponents are clamped so that the result stays a normal float
+		const float minExp2 = -126.f;
+		const float maxExp2 = 127.f;
+
+		inline uint32_t bits(float x) {
+			uint32_t result;
+			memcpy(&result, &x, sizeof(result));
+			return result;
+		}
+
+		inline float fromBits(uint32_t x) {
+			float result;
+			memcpy(&result, &x, sizeof(result));
+			return result;
+		}
+
+		//! Relative error below 3e-7 (2.5 ulp).
+		//! The argument is clamped to [-126, 127], so results are clamped to [2^-126, 2^127].
+		inline float exp2(float x) {
+			x = std::min(std::max(x, minExp2), maxExp2);
+			const auto k = (int)std::lrint(x);
+			// exp(y) for |y| <= ln(2) / 2, Taylor series truncated after y^6
+			const auto y = (x - k) * ln2;
+			const auto p = 1.f + y * (1.f + y * (1.f / 2.f + y * (1.f / 6.f + y * (1.f / 24.f + y * (1.f / 120.f + y * (1.f / 720.f))))));
+			return p * fromBits((uint32_t)(k + 127) << 23);
+		}
+
+		//! Absolute error below 1.2e-7 for x in [0.5, 2], relative error below 1e-7 elsewhere.
+		//! x must be a positive normal float.
+		inline float log2(float x) {
+			const auto xBits = bits(x);
+			auto exponent = (int)(xBits >> 23) - 127;
+			auto mantissa = fromBits((xBits & 0x007fffff) | 0x3f800000);
+			// Keep the mantissa around 1, where the series converges quickly
+			if (mantissa > sqrt2) {
+				mantissa *= .5f;
+				++exponent;
+			}
+			const auto t = (mantissa - 1.f) / (mantissa + 1.f);
+			const auto t2 = t * t;
+			return exponent + t * (log2C1 + t2 * (log2C3 + t2 * (log2C5 + t2 * (log2C7 + t2 * log2C9))));
+		}
+
+		//! x^exponent for x >= 0 and exponent > 0.
+		//! Relative error below 3e-7 + 1e-7 * exponent * max(|log2(x)|, 1), so 3.5e-6 for exponent 32 and x in [0.5, 1].
+		inline float pow(float x, float exponent) {
+			return x > 0.f ? exp2(exponent * log2(x)) : 0.f;
+		}
+
+		//! Clamps to [0, 1], NaN becomes 0
+		inline float saturate(float x) {
+			return x > 0.f ? std::min(x, 1.f) : 0.f;
+		}
+
+#ifdef PLATZ_FAST_MATH_SSE2
+
+		inline __m128 exp2(__m128 x) {
+			x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(minExp2)), _mm_set1_ps(maxExp2));
+			const auto k = _mm_cvtps_epi32(x);
+			const auto y = _mm_mul_ps(_mm_sub_ps(x, _mm_cvtepi32_ps(k)), _mm_set1_ps(ln2));
+			auto p = _mm_add_ps(_mm_mul_ps(y, _mm_set1_ps(1.f / 720.f)), _mm_set1_ps(1.f / 120.f));
+			p = _mm_add_ps(_mm_mul_ps(y, p), _mm_set1_ps(1.f / 24.f));
+			p = _mm_add_ps(_mm_mul_ps(y, p), _mm_set1_ps(1.f / 6.f));
+			p = _mm_add_ps(_mm_mul_ps(y, p), _mm_set1_ps(1.f / 2.f));
+			p = _mm_add_ps(_mm_mul_ps(y, p), _mm_set1_ps(1.f));
+			p = _mm_add_ps(_mm_mul_ps(y, p), _mm_set1_ps(1.f));
+			const auto scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23));
+			return _mm_mul_ps(p, scale);
+		}
+
+		inline __m128 log2(__m128 x) {
+			const auto xBits = _mm_castps_si128(x);
+			auto exponent = _mm_sub_epi32(_mm_srli_epi32(xBits, 23), _mm_set1_epi32(127));
+			auto mantissa = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(xBits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+			const auto high = _mm_cmpgt_ps(mantissa, _mm_set1_ps(sqrt2));
+			mantissa = _mm_or_ps(_mm_andnot_ps(high, mantissa), _mm_and_ps(high, _mm_mul_ps(mantissa, _mm_set1_ps(.5f))));
+			// The mask is -1 where the mantissa was halved
+			exponent = _mm_sub_epi32(exponent, _mm_castps_si128(high));
+
+			const auto one = _mm_set1_ps(1.f);
+			const auto t = _mm_div_ps(_mm_sub_ps(mantissa, one), _mm_add_ps(mantissa, one));
+			const auto t2 = _mm_mul_ps(t, t);
+			auto p = _mm_add_ps(_mm_mul_ps(t2, _mm_set1_ps(log2C9)), _mm_set1_ps(log2C7));
+			p = _mm_add_ps(_mm_mul_ps(t2, p), _mm_set1_ps(log2C5));
+			p = _mm_add_ps(_mm_mul_ps(t2, p), _mm_set1_ps(log2C3));
+			p = _mm_add_ps(_mm_mul_ps(t2, p), _mm_set1_ps(log2C1));
+			return _mm_add_ps(_mm_cvtepi32_ps(exponent), _mm_mul_ps(t, p));
+		}
+
+		inline __m128 saturate(__m128 x) {
+			// maxps returns the second operand for NaN
+			return _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.f));
+		}
+
+#endif
+
+		inline void exp2(const float* x, float* out) {
+#ifdef PLATZ_FAST_MATH_SSE2
+			_mm_store_ps(out, exp2(_mm_load_ps(x)));
+#else
+			for (int i = 0; i < 4; ++i) {
+				out[i] = exp2(x[i]);
+			}
+#endif
+		}
+
+		inline void log2(const float* x, float* out) {
+#ifdef PLATZ_FAST_MATH_SSE2
+			_mm_store_ps(out, log2(_mm_load_ps(x)));
+#else
+			for (int i = 0; i < 4; ++i) {
+				out[i] = log2(x[i]);
+			}
+#endif
+		}
+
+		inline void pow(const float* x, float exponent, float* out) {
+#ifdef PLATZ_FAST_MATH_SSE2
+			const auto v = _mm_load_ps(x);
+			const auto positive = _mm_cmpgt_ps(v, _mm_setzero_ps());
+			const auto result = exp2(_mm_mul_ps(_mm_set1_ps(exponent), log2(v)));
+			_mm_store_ps(out, _mm_and_ps(positive, result));
+#else
+			for (int i = 0; i < 4; ++i) {
+				out[i] = pow(x[i], exponent);
+			}
+#endif
+		}
+
+		inline void saturate(const float* x, float* out) {
+#ifdef PLATZ_FAST_MATH_SSE2
+			_mm_store_ps(out, saturate(_mm_load_ps(x)));
+#else
+			for (int i = 0; i < 4; ++i) {
+				out[i] = saturate(x[i]);
+			}
+#endif
+		}
+
+		//! Normalizes 4 vectors in place, components have an error below 5e-7.
+		//! Zero length vectors stay zero.
+		inline void normalize(float* x, float* y, float* z) {
+#ifdef PLATZ_FAST_MATH_SSE2
+			const auto vx = _mm_load_ps(x);
+			const auto vy = _mm_load_ps(y);
+			const auto vz = _mm_load_ps(z);
+			const auto length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+			// 12-bit estimate refined by one Newton-Raphson step
+			auto r = _mm_rsqrt_ps(length2);
+			r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(.5f), length2), _mm_mul_ps(r, r))));
+			r = _mm_and_ps(r, _mm_cmpgt_ps(length2, _mm_set1_ps(1e-30f)));
+			_mm_store_ps(x, _mm_mul_ps(vx, r));
+			_mm_store_ps(y, _mm_mul_ps(vy, r));
+			_mm_store_ps(z, _mm_mul_ps(vz, r));
+#else
+			for (int i = 0; i < 4; ++i) {
+				const auto length2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+				const auto r = length2 > 1e-30f ? 1.f / std::sqrt(length2) : 0.f;
+				x[i] *= r;
+				y[i] *= r;
+				z[i] *= r;
+			}
+#endif
+		}
+	}
+}
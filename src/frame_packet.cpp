@@ -0,0 +1,64 @@
+
+#include "pch.h"
+#include "frame_packet.h"
+#include "camera.h"
+#include "visual.h"
+#include "entity.h"
+#include "transform.h"
+
+namespace platz {
+
+	void FramePacket::capture(
+		const std::vector<Camera*>& cameras,
+		const std::vector<Visual*>& visuals,
+		const std::vector<Light*>& lights
+	) {
+		views.clear();
+		for (auto camera : cameras) {
+			auto transform = camera->entity()->getComponent<Transform>();
+			views.push_back({
+				camera->projector->getProjectionMatrix() * camera->getViewMatrix(),
+				camera->getFrustum(),
+				transform->worldPosition(),
+				camera->projector->znear,
+				camera->projector->zfar
+			});
+		}
+
+		draws.clear();
+		for (auto visual : visuals) {
+			// The placeholder is drawn until the geometry is loaded
+			auto geometry = visual->geometry;
+			if (!geometry->getVertexBuffer()) {
+				geometry = visual->placeholder;
+			}
+			auto vb = geometry ? geometry->getVertexBuffer() : nullptr;
+			if (!vb) {
+				continue;
+			}
+			draws.push_back({
+				geometry,
+				vb,
+				visual->material,
+				visual->entity()->getComponent<Transform>()->worldMatrix(),
+				visual->receiveShadows,
+				visual->castShadows,
+				visual->vertexLightingSize
+			});
+		}
+
+		this->lights.clear();
+		for (auto light : lights) {
+			auto transform = light->entity()->getComponent<Transform>();
+			this->lights.push_back({
+				light->type,
+				light->intensity,
+				light->range,
+				light->innerAngle,
+				light->outerAngle,
+				transform->worldPosition(),
+				transform->worldForward()
+			});
+		}
+	}
+}
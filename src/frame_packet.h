@@ -0,0 +1,66 @@
+#pragma once
+
+#include "light.h"
+#include "frustum.h"
+#include "matrix44.h"
+#include "vector3.h"
+
+#include <memory>
+#include <vector>
+
+namespace platz {
+
+	class Camera;
+	class Visual;
+	class Geometry;
+	class Material;
+	class Vertexbuffer;
+
+	//! Copy of the scene state read by rendering, captured once per frame after the transforms update.
+	//! Rendering only reads packets, so that the next frame can be simulated while this one is drawn.
+	//! Geometry and materials are shared, not copied, and must not be modified while a frame renders.
+	struct FramePacket {
+
+		struct View {
+			zmath::Matrix44 projectionView;
+			Frustum frustum;
+			zmath::Vector3 position;
+			float znear;
+			float zfar;
+		};
+
+		struct Draw {
+			//! Keeps the vertex buffer alive while the frame renders
+			std::shared_ptr<Geometry> geometry;
+			const Vertexbuffer* vertexbuffer;
+			std::shared_ptr<Material> material;
+			zmath::Matrix44 worldMatrix;
+			bool receiveShadows;
+			bool castShadows;
+			float vertexLightingSize;
+		};
+
+		struct LightState {
+			Light::Type type;
+			float intensity;
+			float range;
+			float innerAngle;
+			float outerAngle;
+			zmath::Vector3 position;
+
+			//! World forward axis of the light
+			zmath::Vector3 direction;
+		};
+
+		std::vector<View> views;
+		std::vector<Draw> draws;
+		std::vector<LightState> lights;
+
+		//! Replaces the content of the packet, reusing its storage
+		void capture(
+			const std::vector<Camera*>& cameras,
+			const std::vector<Visual*>& visuals,
+			const std::vector<Light*>& lights
+		);
+	};
+}
@@ -0,0 +1,138 @@
+
+#include "pch.h"
+#include "framebuffer_upload.h"
+#include "canvas.h"
+
+#include <GLFW/glfw3.h>
+#include <cstring>
+
+namespace platz {
+
+	namespace framebufferupload {
+
+		// From GL 4.4, not in the loader
+		const GLbitfield mapPersistentBit = 0x0040;
+		const GLbitfield mapCoherentBit = 0x0080;
+
+		// From GL 4.1
+		const GLint rgb565 = 0x8D62;
+
+		struct Layout {
+			GLint internalFormat;
+			GLenum format;
+			GLenum type;
+		};
+
+		Layout layout(PixelFormat format) {
+			switch (format) {
+			case PixelFormat::RGBA8: return { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE };
+			case PixelFormat::RGB565: return { rgb565, GL_RGB, GL_UNSIGNED_SHORT_5_6_5 };
+			case PixelFormat::RGBA32F: return { GL_RGBA16F, GL_RGBA, GL_FLOAT };
+			default: return { GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE };
+			}
+		}
+
+		//! Blocks until the GPU is done with a buffer, polling so that a lost context cannot hang
+		void wait(GLsync& fence) {
+			if (!fence) {
+				return;
+			}
+			auto flags = (GLbitfield)0;
+			while (true) {
+				const auto status = glClientWaitSync(fence, flags, 1000000);
+				if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED || status == GL_WAIT_FAILED) {
+					break;
+				}
+				// Make sure the fence was submitted before waiting again
+				flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			}
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
+	FramebufferUpload::FramebufferUpload() {
+		const auto core = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4);
+		if (core || glfwExtensionSupported("GL_ARB_buffer_storage")) {
+			_bufferStorage = (BufferStorage)glfwGetProcAddress("glBufferStorage");
+		}
+		_persistent = _bufferStorage != nullptr;
+	}
+
+	FramebufferUpload::~FramebufferUpload() {
+		release();
+	}
+
+	void FramebufferUpload::resize(GLuint texture, int width, int height, PixelFormat format) {
+		release();
+		_texture = texture;
+		_width = width;
+		_height = height;
+		_format = format;
+		_size = (GLsizeiptr)width * height * Canvas::pixelSize(format);
+
+		// Canvas rows are tightly packed, 2-byte pixels leave odd widths unaligned
+		const auto layout = framebufferupload::layout(format);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, Canvas::pixelSize(format) == 2 ? 2 : 4);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, layout.internalFormat, width, height, 0, layout.format, layout.type, nullptr);
+
+		glGenBuffers(ringSize, _buffers);
+		for (int i = 0; i < ringSize; ++i) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[i]);
+			if (_persistent) {
+				const auto flags = GL_MAP_WRITE_BIT | framebufferupload::mapPersistentBit | framebufferupload::mapCoherentBit;
+				_bufferStorage(GL_PIXEL_UNPACK_BUFFER, _size, nullptr, flags);
+				_mapped[i] = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _size, flags));
+			} else {
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, _size, nullptr, GL_STREAM_DRAW);
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		_next = 0;
+	}
+
+	void FramebufferUpload::upload(const Canvas& canvas) {
+		if (canvas.width() != _width || canvas.height() != _height || canvas.pixelFormat() != _format) {
+			resize(_texture, canvas.width(), canvas.height(), canvas.pixelFormat());
+		}
+
+		const auto slot = _next;
+		_next = (_next + 1) % ringSize;
+		framebufferupload::wait(_fences[slot]);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[slot]);
+		if (_mapped[slot]) {
+			memcpy(_mapped[slot], canvas.pixels(), (size_t)_size);
+		} else {
+			// The fence guarantees the buffer is idle, the driver does not need to synchronize
+			const auto flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+			if (auto mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _size, flags)) {
+				memcpy(mapped, canvas.pixels(), (size_t)_size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_2D, _texture);
+		const auto layout = framebufferupload::layout(_format);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, layout.format, layout.type, nullptr);
+		_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	void FramebufferUpload::release() {
+		for (int i = 0; i < ringSize; ++i) {
+			framebufferupload::wait(_fences[i]);
+			if (_buffers[i]) {
+				if (_mapped[i]) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[i]);
+					glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+					_mapped[i] = nullptr;
+				}
+				glDeleteBuffers(1, &_buffers[i]);
+				_buffers[i] = 0;
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "pixel_format.h"
+
+namespace platz {
+
+	class Canvas;
+
+	//! Streams canvas pixels to a texture through a ring of pixel buffer objects.
+	//! The texture is allocated once per size and format, in a layout matching the canvas so that the driver
+	//! does not have to convert pixels, and updated with glTexSubImage2D from the buffers,
+	//! so the copy to the GPU happens asynchronously while the next frames are written.
+	//! Buffers are persistently mapped when glBufferStorage is available (GL 4.4 or ARB_buffer_storage),
+	//! and mapped with glMapBufferRange every frame otherwise.
+	class FramebufferUpload {
+	public:
+
+		static const int ringSize = 3;
+
+		//! Requires a current GL context
+		FramebufferUpload();
+		~FramebufferUpload();
+
+		FramebufferUpload(const FramebufferUpload&) = delete;
+		FramebufferUpload& operator = (const FramebufferUpload&) = delete;
+
+		//! Allocates the texture storage and the buffers for canvases of this size and format
+		void resize(GLuint texture, int width, int height, PixelFormat format);
+
+		//! Copies the canvas to the next buffer and queues its transfer to the texture.
+		//! Only waits if the buffer is still read by the transfer from ringSize frames ago.
+		void upload(const Canvas& canvas);
+
+		inline bool persistent() const { return _persistent; }
+
+	private:
+
+		void release();
+
+		using BufferStorage = void (APIENTRY*)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+		BufferStorage _bufferStorage = nullptr;
+		bool _persistent = false;
+
+		GLuint _texture = 0;
+		int _width = 0;
+		int _height = 0;
+		PixelFormat _format = PixelFormat::BGRA8;
+		GLsizeiptr _size = 0;
+
+		GLuint _buffers[ringSize] = {};
+		unsigned char* _mapped[ringSize] = {};
+		GLsync _fences[ringSize] = {};
+		int _next = 0;
+	};
+}
@@ -6,6 +6,7 @@ namespace platz {
 	class Geometry {
 	public:
 
+		//! Can return nullptr while the geometry is loading
 		virtual Vertexbuffer* getVertexBuffer() const = 0;
 
 		virtual ~Geometry() = default;
@@ -0,0 +1,291 @@
+
+#include "pch.h"
+#include "job_system.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace platz {
+
+	namespace jobsystem {
+
+		JobSystem::Settings settings;
+		std::mutex instanceMutex;
+		std::unique_ptr<JobSystem> instance;
+		std::atomic<JobSystem*> shared = { nullptr };
+
+		//! Scheduler and deque index of the current thread, -1 if it is not a worker
+		thread_local JobSystem* current = nullptr;
+		thread_local int workerIndex = -1;
+
+		void pin(std::thread& thread, int core) {
+#ifdef _WIN32
+			SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(core, &set);
+			pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+		}
+	}
+
+	bool JobSystem::configure(const Settings& settings) {
+		std::lock_guard<std::mutex> lock(jobsystem::instanceMutex);
+		if (jobsystem::instance) {
+			return false;
+		}
+		jobsystem::settings = settings;
+		return true;
+	}
+
+	JobSystem& JobSystem::instance() {
+		if (auto shared = jobsystem::shared.load(std::memory_order_acquire)) {
+			return *shared;
+		}
+		std::lock_guard<std::mutex> lock(jobsystem::instanceMutex);
+		if (!jobsystem::instance) {
+			jobsystem::instance = std::make_unique<JobSystem>(jobsystem::settings);
+			jobsystem::shared.store(jobsystem::instance.get(), std::memory_order_release);
+		}
+		return *jobsystem::instance;
+	}
+
+	JobSystem::JobSystem(const Settings& settings) {
+		const auto cores = (int)std::max(std::thread::hardware_concurrency(), 2u);
+		// At least one worker, background jobs are never run by waiting threads
+		const auto workerCount = settings.workerCount > 0 ? settings.workerCount : cores - 1;
+
+		// All deques exist before any worker starts stealing
+		for (int i = 0; i < workerCount; ++i) {
+			_workers.push_back(std::make_unique<Worker>());
+		}
+		for (int i = 0; i < workerCount; ++i) {
+			_workers[i]->thread = std::thread(&JobSystem::run, this, i);
+			if (settings.pinWorkers) {
+				jobsystem::pin(_workers[i]->thread, (i + 1) % cores);
+			}
+		}
+	}
+
+	JobSystem::~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(_sleepMutex);
+			_stopping = true;
+		}
+		_wake.notify_all();
+		for (auto& worker : _workers) {
+			worker->thread.join();
+		}
+	}
+
+	JobSystem::Handle JobSystem::submit(std::function<void()> task, Priority priority) {
+		return submit(std::move(task), {}, priority);
+	}
+
+	JobSystem::Handle JobSystem::submit(std::function<void()> task, const std::vector<Handle>& dependencies, Priority priority) {
+		auto job = std::make_shared<Job>();
+		job->_task = std::move(task);
+		job->_priority = priority;
+		for (auto& dependency : dependencies) {
+			if (!dependency) {
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(dependency->_mutex);
+			if (!dependency->done()) {
+				job->_dependencies.fetch_add(1);
+				dependency->_continuations.push_back(job);
+			}
+		}
+		// Release the hold taken at creation, the last dependency to finish queues the job otherwise
+		if (job->_dependencies.fetch_sub(1) == 1) {
+			enqueue(job);
+		}
+		return job;
+	}
+
+	void JobSystem::wait(const Handle& job) {
+		if (!job) {
+			return;
+		}
+		while (!job->done()) {
+			if (auto other = take(false)) {
+				execute(other);
+				continue;
+			}
+			_waiting.fetch_add(1);
+			{
+				std::unique_lock<std::mutex> lock(_sleepMutex);
+				_wake.wait(lock, [&]() { return job->done() || _queued.load() > 0 || _stopping; });
+			}
+			_waiting.fetch_sub(1);
+		}
+	}
+
+	void JobSystem::parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+		grain = std::max(grain, 1);
+		const auto chunkCount = (end - begin + grain - 1) / grain;
+		if (chunkCount <= 1) {
+			if (begin < end) {
+				body(begin, end);
+			}
+			return;
+		}
+
+		// Chunks are claimed dynamically, so uneven chunks balance across threads
+		std::atomic<int> nextChunk = { 0 };
+		auto runChunks = [&]() {
+			for (auto chunk = nextChunk.fetch_add(1); chunk < chunkCount; chunk = nextChunk.fetch_add(1)) {
+				const auto chunkBegin = begin + chunk * grain;
+				body(chunkBegin, std::min(chunkBegin + grain, end));
+			}
+		};
+
+		std::vector<Handle> helpers;
+		const auto helperCount = std::min(chunkCount - 1, workerCount());
+		for (int i = 0; i < helperCount; ++i) {
+			helpers.push_back(submit(runChunks));
+		}
+
+		std::exception_ptr exception;
+		try {
+			runChunks();
+		} catch (...) {
+			exception = std::current_exception();
+			nextChunk.store(chunkCount);
+		}
+
+		// Helpers reference this frame, they must all be done before returning
+		for (auto& helper : helpers) {
+			wait(helper);
+			if (!exception) {
+				exception = helper->exception();
+			}
+		}
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+	}
+
+	void JobSystem::run(int index) {
+		jobsystem::current = this;
+		jobsystem::workerIndex = index;
+		while (true) {
+			if (auto job = take(true)) {
+				execute(job);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(_sleepMutex);
+			_wake.wait(lock, [this]() { return _stopping || _queued.load() > 0 || _queuedBackground.load() > 0; });
+			// Queued jobs are still run when stopping
+			if (_stopping && _queued.load() == 0 && _queuedBackground.load() == 0) {
+				return;
+			}
+		}
+	}
+
+	void JobSystem::enqueue(Handle job) {
+		if (job->_priority == Priority::Background) {
+			std::lock_guard<std::mutex> lock(_backgroundMutex);
+			_background.push_back(std::move(job));
+			_queuedBackground.fetch_add(1);
+		} else if (jobsystem::current == this && jobsystem::workerIndex >= 0) {
+			auto& worker = *_workers[jobsystem::workerIndex];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			worker.jobs.push_back(std::move(job));
+			_queued.fetch_add(1);
+		} else {
+			std::lock_guard<std::mutex> lock(_injectedMutex);
+			_injected.push_back(std::move(job));
+			_queued.fetch_add(1);
+		}
+
+		// Taking the lock orders the count update with sleeping threads checking it
+		{
+			std::lock_guard<std::mutex> lock(_sleepMutex);
+		}
+		_wake.notify_all();
+	}
+
+	void JobSystem::execute(const Handle& job) {
+		try {
+			job->_task();
+		} catch (...) {
+			job->_exception = std::current_exception();
+		}
+		// Release what the task captured before continuations run
+		job->_task = nullptr;
+
+		std::vector<Handle> continuations;
+		{
+			std::lock_guard<std::mutex> lock(job->_mutex);
+			job->_done.store(true);
+			continuations.swap(job->_continuations);
+		}
+		for (auto& continuation : continuations) {
+			if (continuation->_dependencies.fetch_sub(1) == 1) {
+				enqueue(continuation);
+			}
+		}
+		if (_waiting.load() > 0) {
+			{
+				std::lock_guard<std::mutex> lock(_sleepMutex);
+			}
+			_wake.notify_all();
+		}
+	}
+
+	JobSystem::Handle JobSystem::take(bool background) {
+		Handle job;
+		const auto self = jobsystem::current == this ? jobsystem::workerIndex : -1;
+		if (self >= 0) {
+			// Newest first from the own deque, its data is likely still in cache
+			auto& worker = *_workers[self];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			if (!worker.jobs.empty()) {
+				job = std::move(worker.jobs.back());
+				worker.jobs.pop_back();
+			}
+		}
+		if (!job) {
+			job = popFront(_injectedMutex, _injected);
+		}
+		if (!job) {
+			// Oldest first from the others, which are usually the largest pieces of work left
+			const auto count = workerCount();
+			for (int i = 1; i <= count && !job; ++i) {
+				const auto victim = (self + i) % count;
+				if (victim != self) {
+					job = popFront(_workers[victim]->mutex, _workers[victim]->jobs);
+				}
+			}
+		}
+		if (job) {
+			_queued.fetch_sub(1);
+			return job;
+		}
+
+		if (background) {
+			job = popFront(_backgroundMutex, _background);
+			if (job) {
+				_queuedBackground.fetch_sub(1);
+			}
+		}
+		return job;
+	}
+
+	JobSystem::Handle JobSystem::popFront(std::mutex& mutex, std::deque<Handle>& jobs) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (jobs.empty()) {
+			return nullptr;
+		}
+		auto job = std::move(jobs.front());
+		jobs.pop_front();
+		return job;
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace platz {
+
+	class Job;
+
+	//! Work-stealing scheduler shared by the engine, the asset loaders and user code.
+	//! Each worker pushes and pops the jobs it submits at the back of its own deque, idle workers
+	//! steal from the front of the others. Threads waiting for a job run other frame jobs meanwhile.
+	class JobSystem {
+	public:
+
+		struct Settings {
+			//! Worker threads, one per core minus one for the main thread if 0 or less
+			int workerCount = 0;
+
+			//! Pins worker i to core i + 1, leaving core 0 to the main thread
+			bool pinWorkers = false;
+		};
+
+		enum class Priority {
+			//! Frame work, also run by threads waiting for a job
+			High,
+
+			//! Long running work such as file IO and decoding, only run by idle workers
+			Background
+		};
+
+		using Handle = std::shared_ptr<Job>;
+
+		//! Applies to the shared instance, returns false if it already started
+		static bool configure(const Settings& settings);
+
+		//! Shared instance, started on first use
+		static JobSystem& instance();
+
+		JobSystem(const Settings& settings);
+		~JobSystem();
+
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator = (const JobSystem&) = delete;
+
+		Handle submit(std::function<void()> task, Priority priority = Priority::High);
+
+		//! The job is queued once all its dependencies are done
+		Handle submit(std::function<void()> task, const std::vector<Handle>& dependencies, Priority priority = Priority::High);
+
+		//! Blocks until the job is done, running frame jobs in the meantime
+		void wait(const Handle& job);
+
+		//! Calls body(chunkBegin, chunkEnd) over [begin, end) in chunks of grain elements, and waits for all of them.
+		//! The calling thread takes part. Rethrows the first exception thrown by body.
+		void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+		inline int workerCount() const { return (int)_workers.size(); }
+
+	private:
+
+		struct Worker {
+			std::thread thread;
+			std::mutex mutex;
+			std::deque<Handle> jobs;
+		};
+
+		void run(int index);
+
+		void enqueue(Handle job);
+
+		//! Runs the task, then queues the continuations whose dependencies are all done
+		void execute(const Handle& job);
+
+		//! Takes a job from the own deque, the queue of other threads, then steals from other workers.
+		//! Background jobs are only taken if background is true.
+		Handle take(bool background);
+
+		static Handle popFront(std::mutex& mutex, std::deque<Handle>& jobs);
+
+		std::vector<std::unique_ptr<Worker>> _workers;
+
+		//! Frame jobs submitted by threads that are not workers
+		std::mutex _injectedMutex;
+		std::deque<Handle> _injected;
+
+		std::mutex _backgroundMutex;
+		std::deque<Handle> _background;
+
+		//! Queued jobs, idle threads sleep while there are none they can take
+		std::atomic<int> _queued = { 0 };
+		std::atomic<int> _queuedBackground = { 0 };
+		std::atomic<int> _waiting = { 0 };
+		std::mutex _sleepMutex;
+		std::condition_variable _wake;
+		bool _stopping = false;
+	};
+
+	class Job {
+		friend class JobSystem;
+
+	public:
+
+		inline bool done() const { return _done.load(std::memory_order_acquire); }
+
+		//! Set if the task threw, once done
+		inline std::exception_ptr exception() const { return _exception; }
+
+	private:
+
+		std::function<void()> _task;
+		JobSystem::Priority _priority = JobSystem::Priority::High;
+
+		//! Dependencies not done yet, plus one held by submit() until they are all registered
+		std::atomic<int> _dependencies = { 1 };
+
+		//! Guards _continuations and the transition to done
+		std::mutex _mutex;
+		std::vector<JobSystem::Handle> _continuations;
+		std::atomic<bool> _done = { false };
+		std::exception_ptr _exception;
+	};
+}
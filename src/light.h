@@ -3,17 +3,40 @@
 #include "component.h"
 
 namespace platz {
+
+	//! Lights shine along the forward axis of their transform, point and spot lights from its world position
 	class Light : public Component {
-		DECLARE_OBJECT(Light, Component);	
+		DECLARE_OBJECT(Light, Component);
 
 	public:
 
+		enum class Type {
+			//! Lights the whole scene from an infinite distance, the only type casting shadows
+			Directional,
+			Point,
+			Spot
+		};
+
+		Type type = Type::Directional;
 		float intensity = 1.f;
 
+		//! Distance at which point and spot lights fade out completely
+		float range = 10.f;
+
+		//! Half angles of spot cones in radians, full intensity inside the inner angle
+		float innerAngle = .3f;
+		float outerAngle = .5f;
+
 		Light(float _intensity = 1.f)
 			: intensity(_intensity) {
 
 		}
+
+		Light(Type _type, float _intensity, float _range = 10.f)
+			: type(_type)
+			, intensity(_intensity)
+			, range(_range) {
+
+		}
 	};
 }
-
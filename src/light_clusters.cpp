@@ -0,0 +1,153 @@
+
+#include "pch.h"
+#include "light_clusters.h"
+#include "vector4.h"
+
+namespace platz {
+
+	void LightClusters::build(
+		const std::vector<FramePacket::LightState>& lights,
+		const zmath::Matrix44& projectionView,
+		int width,
+		int height,
+		float znear,
+		float zfar
+	) {
+		_local.clear();
+		_bounds.clear();
+		_indices.clear();
+
+		_tilesX = std::max((width + tileSize - 1) >> tileShift, 1);
+		_tilesY = std::max((height + tileSize - 1) >> tileShift, 1);
+		_znear = znear;
+		_zfar = zfar;
+		_sliceScale = depthSlices / std::log(zfar / znear);
+
+		// The w row of the projection, clip space w is affine in the world position
+		_depthOffset = (projectionView * zmath::Vector4(zmath::Vector3::zero, 1.f)).w;
+		_depthAxis = zmath::Vector3(
+			(projectionView * zmath::Vector4(zmath::Vector3(1.f, 0.f, 0.f), 0.f)).w,
+			(projectionView * zmath::Vector4(zmath::Vector3(0.f, 1.f, 0.f), 0.f)).w,
+			(projectionView * zmath::Vector4(zmath::Vector3(0.f, 0.f, 1.f), 0.f)).w
+		);
+
+		const auto clusterCount = _tilesX * _tilesY * depthSlices;
+		_offsets.assign(clusterCount + 1, 0);
+
+		for (auto& light : lights) {
+			if (light.type == Light::Type::Directional || light.range <= 0.f || light.intensity <= 0.f) {
+				continue;
+			}
+
+			const auto position = light.position;
+			Bounds lightBounds;
+			if (!bounds(position, light.range, projectionView, width, height, lightBounds)) {
+				continue;
+			}
+
+			LocalLight local;
+			local.position = position;
+			local.intensity = light.intensity;
+			local.invRange2 = 1.f / (light.range * light.range);
+			if (light.type == Light::Type::Spot) {
+				local.direction = light.direction;
+				local.cosOuter = std::cos(light.outerAngle);
+				const auto cosInner = std::cos(std::min(light.innerAngle, light.outerAngle));
+				local.invConeRange = cosInner > local.cosOuter ? 1.f / (cosInner - local.cosOuter) : 1e6f;
+			} else {
+				local.direction = zmath::Vector3::forward;
+				local.cosOuter = -2.f;
+				local.invConeRange = 1.f;
+			}
+			_local.push_back(local);
+			_bounds.push_back(lightBounds);
+
+			for (int slice = lightBounds.minSlice; slice <= lightBounds.maxSlice; ++slice) {
+				for (int tileY = lightBounds.minTileY; tileY <= lightBounds.maxTileY; ++tileY) {
+					for (int tileX = lightBounds.minTileX; tileX <= lightBounds.maxTileX; ++tileX) {
+						++_offsets[(slice * _tilesY + tileY) * _tilesX + tileX + 1];
+					}
+				}
+			}
+		}
+
+		for (int i = 0; i < clusterCount; ++i) {
+			_offsets[i + 1] += _offsets[i];
+		}
+
+		// Lights are appended in order, which keeps each cluster list sorted
+		_indices.resize(_offsets[clusterCount]);
+		_cursors.assign(_offsets.begin(), _offsets.end() - 1);
+		for (int light = 0; light < (int)_bounds.size(); ++light) {
+			auto& lightBounds = _bounds[light];
+			for (int slice = lightBounds.minSlice; slice <= lightBounds.maxSlice; ++slice) {
+				for (int tileY = lightBounds.minTileY; tileY <= lightBounds.maxTileY; ++tileY) {
+					for (int tileX = lightBounds.minTileX; tileX <= lightBounds.maxTileX; ++tileX) {
+						_indices[_cursors[(slice * _tilesY + tileY) * _tilesX + tileX]++] = light;
+					}
+				}
+			}
+		}
+	}
+
+	bool LightClusters::bounds(
+		const zmath::Vector3& center,
+		float radius,
+		const zmath::Matrix44& projectionView,
+		int width,
+		int height,
+		Bounds& bounds
+	) const {
+		const auto centerDepth = depth(center.x, center.y, center.z);
+		if (centerDepth + radius <= _znear || centerDepth - radius >= _zfar) {
+			return false;
+		}
+		bounds.minSlice = slice(centerDepth - radius);
+		bounds.maxSlice = slice(centerDepth + radius);
+
+		// Project the corners of the box around the sphere, the whole screen if the box crosses the camera plane
+		auto minX = 0.f;
+		auto minY = 0.f;
+		auto maxX = (float)width;
+		auto maxY = (float)height;
+		auto inFront = true;
+		zmath::Vector3 corners[8];
+		for (int i = 0; i < 8; ++i) {
+			const auto corner = zmath::Vector3(
+				center.x + ((i & 1) ? radius : -radius),
+				center.y + ((i & 2) ? radius : -radius),
+				center.z + ((i & 4) ? radius : -radius)
+			);
+			const auto clip = projectionView * zmath::Vector4(corner, 1.f);
+			if (clip.w <= 1e-5f) {
+				inFront = false;
+				break;
+			}
+			// Same mapping as Canvas::drawTriangle()
+			corners[i] = zmath::Vector3(
+				(clip.x / clip.w + 1.f) / 2.f * width,
+				(-clip.y / clip.w + 1.f) / 2.f * height,
+				0.f
+			);
+		}
+		if (inFront) {
+			minX = maxX = corners[0].x;
+			minY = maxY = corners[0].y;
+			for (int i = 1; i < 8; ++i) {
+				minX = std::min(minX, corners[i].x);
+				minY = std::min(minY, corners[i].y);
+				maxX = std::max(maxX, corners[i].x);
+				maxY = std::max(maxY, corners[i].y);
+			}
+			if (maxX < 0.f || maxY < 0.f || minX >= width || minY >= height) {
+				return false;
+			}
+		}
+
+		bounds.minTileX = (int)std::max(minX, 0.f) >> tileShift;
+		bounds.minTileY = (int)std::max(minY, 0.f) >> tileShift;
+		bounds.maxTileX = std::min((int)std::min(maxX, (float)width) >> tileShift, _tilesX - 1);
+		bounds.maxTileY = std::min((int)std::min(maxY, (float)height) >> tileShift, _tilesY - 1);
+		return true;
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "vector3.h"
+#include "matrix44.h"
+#include "frame_packet.h"
+
+#include <vector>
+
+namespace platz {
+
+	//! Point and spot lights sorted every frame into a grid of screen tiles and view depth slices,
+	//! so that a pixel only loops over the lights whose range can reach its cluster.
+	class LightClusters {
+	public:
+
+		//! Tile side in pixels, even so that 2x2 quads never straddle two tiles
+		static const int tileSize = 32;
+		static const int tileShift = 5;
+
+		//! Slices are spaced exponentially between the near and far planes, like perspective precision
+		static const int depthSlices = 16;
+
+		//! Point or spot light resolved to world space for the frame
+		struct LocalLight {
+			zmath::Vector3 position;
+
+			//! Spot axis, unused by point lights
+			zmath::Vector3 direction;
+			float intensity;
+			float invRange2;
+
+			//! Cone factor is saturate((cos - cosOuter) * invConeRange).
+			//! Point lights use -2 and 1, which is 1 for any direction.
+			float cosOuter;
+			float invConeRange;
+		};
+
+		//! Bins the point and spot lights, for a camera rendering to a width x height canvas
+		void build(
+			const std::vector<FramePacket::LightState>& lights,
+			const zmath::Matrix44& projectionView,
+			int width,
+			int height,
+			float znear,
+			float zfar
+		);
+
+		inline const std::vector<LocalLight>& localLights() const { return _local; }
+
+		//! View depth of a world position, which is the w of its clip space position
+		inline float depth(float x, float y, float z) const {
+			return _depthAxis.x * x + _depthAxis.y * y + _depthAxis.z * z + _depthOffset;
+		}
+
+		//! Cluster of a pixel at a view depth
+		inline int cluster(int x, int y, float depth) const {
+			const auto tileX = std::min(std::max(x >> tileShift, 0), _tilesX - 1);
+			const auto tileY = std::min(std::max(y >> tileShift, 0), _tilesY - 1);
+			return (slice(depth) * _tilesY + tileY) * _tilesX + tileX;
+		}
+
+		//! Indices in localLights() of the lights reaching a cluster, in increasing order
+		inline const int* begin(int cluster) const { return _indices.data() + _offsets[cluster]; }
+		inline const int* end(int cluster) const { return _indices.data() + _offsets[cluster + 1]; }
+
+	private:
+
+		//! Clusters covered by a light, bounds included
+		struct Bounds {
+			int minTileX;
+			int maxTileX;
+			int minTileY;
+			int maxTileY;
+			int minSlice;
+			int maxSlice;
+		};
+
+		inline int slice(float depth) const {
+			if (depth <= _znear) {
+				return 0;
+			}
+			return std::min((int)(std::log(depth / _znear) * _sliceScale), depthSlices - 1);
+		}
+
+		//! Returns false if the sphere is outside of the view
+		bool bounds(
+			const zmath::Vector3& center,
+			float radius,
+			const zmath::Matrix44& projectionView,
+			int width,
+			int height,
+			Bounds& bounds
+		) const;
+
+		std::vector<LocalLight> _local;
+		std::vector<Bounds> _bounds;
+
+		//! Lights of cluster i are _indices[_offsets[i]] to _indices[_offsets[i + 1]] excluded
+		std::vector<int> _offsets;
+		std::vector<int> _indices;
+		std::vector<int> _cursors;
+
+		int _tilesX = 1;
+		int _tilesY = 1;
+		float _znear = .1f;
+		float _zfar = 100.f;
+		float _sliceScale = 1.f;
+		zmath::Vector3 _depthAxis;
+		float _depthOffset = 0.f;
+	};
+}
@@ -16,7 +16,8 @@
 #include "perspective_projector.h"
 #include "procedural_mesh.h"
 
-#include "obj_loader.h"
+#include "assets.h"
+#include "mesh.h"
 
 #include "plane.h"
 #include "triangle.h"
@@ -31,10 +32,10 @@ using namespace zmath;
 int main(void) {	
 
 	{
-		std::shared_ptr<Vertexbuffer> cubeVb(OBJLoader::load("media/cube.obj"));
-		std::shared_ptr<Vertexbuffer> planeVb(OBJLoader::load("media/plane.obj"));
-		std::shared_ptr<Vertexbuffer> sphereVb(OBJLoader::load("media/sphere.obj"));
-		std::shared_ptr<Vertexbuffer> bunnyVb(OBJLoader::load("media/bunny.obj"));
+		auto cubeMesh = Assets::loadMesh("media/cube.obj");
+		auto planeMesh = Assets::loadMesh("media/plane.obj");
+		auto sphereMesh = Assets::loadMesh("media/sphere.obj");
+		auto bunnyMesh = Assets::loadMesh("media/bunny.obj");
 
 		auto camera = Entities::create()
 			->setComponent<Camera>(new PerspectiveProjector(60.f, 1.f, 100.f))
@@ -44,10 +45,16 @@ int main(void) {
 			->setComponent<Transform>(Vector3(0, 0, 0), Quaternion(Vector3(zmath::radians(140), 0, 0)), Vector3::one)
 			->setComponent<Light>();
 
-		auto woodTex = std::make_shared<Texture>("media/wood.png");
-		auto crateTex = std::make_shared<Texture>("media/crate.png");
-		auto metalTex = std::make_shared<Texture>("media/metal.png");
-		auto checkerTex = std::make_shared<Texture>("media/checker.png");
+		auto textures = Assets::loadTextures({
+			"media/wood.png",
+			"media/crate.png",
+			"media/metal.png",
+			"media/checker.png"
+		});
+		auto woodTex = textures[0];
+		auto crateTex = textures[1];
+		auto metalTex = textures[2];
+		auto checkerTex = textures[3];
 		auto metalMat = std::make_shared<PhongMaterial>(Color(0, .05f, 0, 1), metalTex, 32.f);
 		auto checkerMat = std::make_shared<PhongMaterial>(Color::white * .1f, checkerTex, 32.f);
 		auto woodMat = std::make_shared<PhongMaterial>(Color::white * .1f, woodTex, 32.f);
@@ -72,7 +79,7 @@ int main(void) {
 		auto cube = Entities::create()
 			->setComponent<Transform>(Vector3(1, 1, 1), Quaternion::identity, Vector3::one * .5f)
 			->setComponent<Visual>(
-				std::make_shared<ProceduralMesh>(cubeVb),
+				cubeMesh,
 				crateMat
 				);
 		cube->getComponent<Visual>()->receiveShadows = false;
@@ -81,7 +88,7 @@ int main(void) {
 		auto bunny = Entities::create()
 			->setComponent<Transform>(Vector3(0, 0, 2), Quaternion::identity, Vector3::one * 7.f)
 			->setComponent<Visual>(
-				std::make_shared<ProceduralMesh>(bunnyVb),
+				bunnyMesh,
 				metalMat
 				);
 		bunny->getComponent<Visual>()->receiveShadows = false;
@@ -0,0 +1,83 @@
+
+#include "pch.h"
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace platz {
+
+#ifdef _WIN32
+	MappedFile::MappedFile(const std::string& path) {
+		auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return;
+		}
+		_file = file;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			return;
+		}
+
+		_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!_mapping) {
+			return;
+		}
+
+		_data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+		if (_data) {
+			_size = (size_t)size.QuadPart;
+		}
+	}
+
+	MappedFile::~MappedFile() {
+		if (_data) {
+			UnmapViewOfFile(_data);
+		}
+		if (_mapping) {
+			CloseHandle(_mapping);
+		}
+		if (_file) {
+			CloseHandle(_file);
+		}
+	}
+#else
+	MappedFile::MappedFile(const std::string& path) {
+		_file = open(path.c_str(), O_RDONLY);
+		if (_file < 0) {
+			return;
+		}
+
+		struct stat info;
+		if (fstat(_file, &info) != 0 || info.st_size == 0) {
+			return;
+		}
+
+		auto data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, _file, 0);
+		if (data == MAP_FAILED) {
+			return;
+		}
+		madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+		_data = static_cast<const char*>(data);
+		_size = (size_t)info.st_size;
+	}
+
+	MappedFile::~MappedFile() {
+		if (_data) {
+			munmap(const_cast<char*>(_data), _size);
+		}
+		if (_file >= 0) {
+			close(_file);
+		}
+	}
+#endif
+}
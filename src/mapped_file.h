@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+namespace platz {
+
+	//! Read-only memory mapping of a whole file
+	class MappedFile {
+	public:
+
+		MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator = (const MappedFile&) = delete;
+
+		inline bool valid() const { return _data != nullptr; }
+		inline const char* data() const { return _data; }
+		inline size_t size() const { return _size; }
+
+	private:
+
+		const char* _data = nullptr;
+		size_t _size = 0;
+
+#ifdef _WIN32
+		void* _file = nullptr;
+		void* _mapping = nullptr;
+#else
+		int _file = -1;
+#endif
+	};
+}
@@ -1,7 +1,13 @@
-
 #include "pch.h"
 #include "material.h"
 
 namespace platz {
 
+	void Material::shadeQuad(const ShadingContext& context, const Fragments& fragments, Color4& out) const {
+		for (int i = 0; i < Fragments::count; ++i) {
+			if (fragments.mask & (1 << i)) {
+				out.set(i, shade(context, fragments.vertex(i), fragments.derivatives));
+			}
+		}
+	}
 }
@@ -5,10 +5,67 @@
 
 namespace platz {
 
+	//! Interpolated attributes of a 2x2 pixel quad, one array per component.
+	//! Pixels are ordered top-left, top-right, bottom-left, bottom-right.
+	struct Fragments {
+		static const int count = 4;
+
+		//! Bit i is set if pixel i is covered and passed the depth test, other pixels hold undefined values
+		int mask;
+
+		//! Canvas coordinates of the top-left pixel, negative when shading outside of a canvas
+		int x;
+		int y;
+
+		alignas(16) float positionX[count];
+		alignas(16) float positionY[count];
+		alignas(16) float positionZ[count];
+		alignas(16) float normalX[count];
+		alignas(16) float normalY[count];
+		alignas(16) float normalZ[count];
+		alignas(16) float u[count];
+		alignas(16) float v[count];
+		alignas(16) float colorR[count];
+		alignas(16) float colorG[count];
+		alignas(16) float colorB[count];
+
+		//! Interpolated Vertex::lighting, only set when ShadingContext::vertexLighting is true
+		alignas(16) float lightDiffuse[count];
+		alignas(16) float lightSpecular[count];
+		alignas(16) float lightAmbient[count];
+
+		UVDerivatives derivatives;
+
+		inline Vertex vertex(int i) const {
+			return {
+				{ positionX[i], positionY[i], positionZ[i], 1.f },
+				{ u[i], v[i] },
+				{ normalX[i], normalY[i], normalZ[i] },
+				{ colorR[i], colorG[i], colorB[i] }
+			};
+		}
+	};
+
 	class Material {
 	public:
 
-		virtual Color shade(const ShadingContext& context, const Vertex& vertex) const = 0;
+		//! Light per vertex at any size, see Visual::vertexLightingSize.
+		//! Ignored if the material does not support vertex lighting.
+		bool vertexLighting = false;
+
+		//! Called once per draw, before shading. The context is the same for all the triangles of the draw.
+		virtual void prepare(const ShadingContext& context) {}
+
+		//! True if lightVertex() is implemented
+		virtual bool supportsVertexLighting() const { return false; }
+
+		//! Sets the light terms of a vertex in world space, for draws with ShadingContext::vertexLighting
+		virtual void lightVertex(const ShadingContext& context, Vertex& vertex) const {}
+
+		virtual Color shade(const ShadingContext& context, const Vertex& vertex, const UVDerivatives& derivatives) const = 0;
+
+		//! Shades the pixels of a quad in one call, only the pixels in fragments.mask have to be written.
+		//! Calls shade() for each pixel by default.
+		virtual void shadeQuad(const ShadingContext& context, const Fragments& fragments, Color4& out) const;
 	};
 }
-
@@ -0,0 +1,16 @@
+
+#include "pch.h"
+#include "mesh.h"
+#include "obj_loader.h"
+
+namespace platz {
+
+	Mesh::Mesh(const std::string& path) {
+		load(path);
+	}
+
+	void Mesh::load(const std::string& path) {
+		_vertexBuffer.reset(OBJLoader::load(path));
+		setReady();
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "geometry.h"
+#include "asset.h"
+
+namespace platz {
+
+	//! Geometry loaded from a file. Has no vertex buffer until loading completes.
+	class Mesh : public Geometry, public Asset {
+		friend class Assets;
+
+		std::shared_ptr<Vertexbuffer> _vertexBuffer;
+
+	public:
+
+		Mesh(const std::string& path);
+
+		Vertexbuffer* getVertexBuffer() const override {
+			return ready() ? _vertexBuffer.get() : nullptr;
+		}
+
+	private:
+
+		Mesh() = default;
+
+		void load(const std::string& path);
+	};
+}
@@ -1,87 +1,277 @@
 
 #include "pch.h"
 #include "obj_loader.h"
+#include "mapped_file.h"
+#include "job_system.h"
 
-#include <fstream>
-#include <sstream>
+#include <charconv>
+#include <functional>
 
 namespace platz {
-	Vertexbuffer* OBJLoader::load(const std::string& path) {
-		std::ifstream file(path);
-		std::string line;
 
-		struct Indices {
+	namespace objloader {
+
+		//! Files smaller than this are parsed on the calling thread
+		const size_t minChunkSize = 1 << 20;
+
+		//! 0-based attribute indices of a face corner, -1 when the attribute is missing
+		struct Corner {
 			int vertex;
 			int uv;
 			int normal;
 		};
 
-		struct Face {
-			Indices indices[3];
+		enum RelativeFlags {
+			RelativeVertex = 1 << 0,
+			RelativeUv = 1 << 1,
+			RelativeNormal = 1 << 2
+		};
+
+		struct RelativeCorner {
+			size_t corner;
+			int flags;
 		};
 
-		std::vector<zmath::Vector3> rawVertices;
-		std::vector<zmath::Vector2> rawUvs;
-		std::vector<zmath::Vector3> rawNormals;
-		std::vector<Face> faces;
-		while (std::getline(file, line)) {
+		//! Result of parsing one slice of the file
+		struct Chunk {
+			std::vector<zmath::Vector3> positions;
+			std::vector<zmath::Vector2> uvs;
+			std::vector<zmath::Vector3> normals;
+
+			//! Triangulated faces, 3 corners per triangle
+			std::vector<Corner> corners;
 
-			if (line.at(0) == '#') {
-				continue;
+			//! Corners using negative (relative) indices, which are resolved against the counts local to this chunk.
+			//! They are rebased once the counts of previous chunks are known.
+			std::vector<RelativeCorner> relativeCorners;
+
+			//! Element counts of all previous chunks
+			int positionOffset = 0;
+			int uvOffset = 0;
+			int normalOffset = 0;
+			size_t vertexOffset = 0;
+		};
+
+		inline const char* skipSpaces(const char* p, const char* end) {
+			while (p < end && (*p == ' ' || *p == '\t')) {
+				++p;
 			}
+			return p;
+		}
+
+		inline const char* skipLine(const char* p, const char* end) {
+			auto newLine = static_cast<const char*>(memchr(p, '\n', end - p));
+			return newLine ? newLine + 1 : end;
+		}
+
+		inline const char* parseFloat(const char* p, const char* end, float& value) {
+			p = skipSpaces(p, end);
+			if (p < end && *p == '+') {
+				++p;
+			}
+			value = 0.f;
+			return std::from_chars(p, end, value).ptr;
+		}
 
-			std::istringstream iss(line);
-			std::string command;
-			iss >> command;
-
-			if (command == "v") {
-				float x, y, z;
-				iss >> x >> y >> z;
-				rawVertices.push_back({ x, y , z });
-
-			} else if (command == "vt") {
-				float u, v;
-				iss >> u >> v;
-				rawUvs.push_back({ u, v });
-
-			} else if (command == "vn") {
-				float x, y, z;
-				iss >> x >> y >> z;
-				rawNormals.push_back({ x, y , z });
-
-			} else if (command == "f") {
-
-				std::string vertices[3];
-				iss >> vertices[0] >> vertices[1] >> vertices[2];
-				Indices indices[3];
-				for (int i = 0; i < 3; i++) {
-					std::istringstream vIss(vertices[i]);
-					std::string p, t, n;
-					std::getline(vIss, p, '/');
-					std::getline(vIss, t, '/');
-					std::getline(vIss, n, '/');
-					indices[i] = { std::stoi(p) - 1, std::stoi(t) - 1, std::stoi(n) - 1};
+		//! Parses an OBJ index and converts it to a 0-based index. Returns false if no index is present.
+		inline bool parseIndex(const char*& p, const char* end, int count, int& index, int& flags, int relativeFlag) {
+			int value = 0;
+			auto result = std::from_chars(p, end, value);
+			if (result.ec != std::errc() || value == 0) {
+				return false;
+			}
+			p = result.ptr;
+			if (value < 0) {
+				index = count + value;
+				flags |= relativeFlag;
+			} else {
+				index = value - 1;
+			}
+			return true;
+		}
+
+		void parse(const char* p, const char* end, Chunk& chunk) {
+			std::vector<Corner> polygon;
+			std::vector<int> polygonFlags;
+			while (p < end) {
+				p = skipSpaces(p, end);
+				if (p == end) {
+					break;
+				}
+
+				if (p[0] == 'v') {
+					if (p + 1 < end && (p[1] == ' ' || p[1] == '\t')) {
+						zmath::Vector3 v;
+						p = parseFloat(p + 1, end, v.x);
+						p = parseFloat(p, end, v.y);
+						p = parseFloat(p, end, v.z);
+						chunk.positions.push_back(v);
+
+					} else if (p + 2 < end && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+						zmath::Vector2 uv;
+						p = parseFloat(p + 2, end, uv.x);
+						p = parseFloat(p, end, uv.y);
+						chunk.uvs.push_back(uv);
+
+					} else if (p + 2 < end && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+						zmath::Vector3 n;
+						p = parseFloat(p + 2, end, n.x);
+						p = parseFloat(p, end, n.y);
+						p = parseFloat(p, end, n.z);
+						chunk.normals.push_back(n);
+					}
+
+				} else if (p[0] == 'f' && p + 1 < end && (p[1] == ' ' || p[1] == '\t')) {
+					// Formats: v, v/vt, v//vn, v/vt/vn
+					polygon.clear();
+					polygonFlags.clear();
+					++p;
+					while (true) {
+						p = skipSpaces(p, end);
+						Corner corner = { -1, -1, -1 };
+						auto flags = 0;
+						if (!parseIndex(p, end, (int)chunk.positions.size(), corner.vertex, flags, RelativeVertex)) {
+							break;
+						}
+						if (p < end && *p == '/') {
+							++p;
+							parseIndex(p, end, (int)chunk.uvs.size(), corner.uv, flags, RelativeUv);
+							if (p < end && *p == '/') {
+								++p;
+								parseIndex(p, end, (int)chunk.normals.size(), corner.normal, flags, RelativeNormal);
+							}
+						}
+						polygon.push_back(corner);
+						polygonFlags.push_back(flags);
+					}
+
+					// Triangulate as a fan around the first corner
+					for (size_t i = 1; i + 1 < polygon.size(); ++i) {
+						const size_t fan[3] = { 0, i, i + 1 };
+						for (auto c : fan) {
+							if (polygonFlags[c]) {
+								chunk.relativeCorners.push_back({ chunk.corners.size(), polygonFlags[c] });
+							}
+							chunk.corners.push_back(polygon[c]);
+						}
+					}
 				}
-				faces.push_back({ indices[0], indices[1], indices[2] });
+
+				p = skipLine(p, end);
 			}
-		}		
-
-		std::vector<Vertex> vertices;
-		for (auto& face : faces) {
-			for (int i = 0; i < 3; ++i) {
-				auto position = rawVertices[face.indices[i].vertex];
-				auto uv = rawUvs[face.indices[i].uv];
-				auto normal = rawNormals[face.indices[i].normal];
-				Vertex v = {
-					{ position, 1 },
-					uv,
-					normal,
-					{ 1, 1, 1, 1}
-				};
-				vertices.push_back(v);
+		}
+
+		template <typename T>
+		inline const T* fetch(const std::vector<T>& values, int index) {
+			return (index >= 0 && index < (int)values.size()) ? &values[index] : nullptr;
+		}
+
+		void build(
+			const Chunk& chunk,
+			const std::vector<zmath::Vector3>& positions,
+			const std::vector<zmath::Vector2>& uvs,
+			const std::vector<zmath::Vector3>& normals,
+			Vertex* out
+		) {
+			for (size_t i = 0; i < chunk.corners.size(); i += 3) {
+				zmath::Vector3 p[3];
+				for (int j = 0; j < 3; ++j) {
+					auto position = fetch(positions, chunk.corners[i + j].vertex);
+					p[j] = position ? *position : zmath::Vector3::zero;
+				}
+
+				// Flat normal for corners without one
+				auto faceNormal = (p[1] - p[0]).cross(p[2] - p[0]).normalized();
+
+				for (int j = 0; j < 3; ++j) {
+					auto& corner = chunk.corners[i + j];
+					auto uv = fetch(uvs, corner.uv);
+					auto normal = fetch(normals, corner.normal);
+					out[i + j] = {
+						{ p[j], 1 },
+						uv ? *uv : zmath::Vector2(0, 0),
+						normal ? *normal : faceNormal,
+						{ 1, 1, 1, 1 }
+					};
+				}
 			}
 		}
-		return new Vertexbuffer(vertices);
 	}
-}
 
+	Vertexbuffer* OBJLoader::load(const std::string& path) {
+		using namespace objloader;
+
+		MappedFile file(path);
+		if (!file.valid()) {
+			return new Vertexbuffer(std::vector<Vertex>());
+		}
+
+		const auto begin = file.data();
+		const auto end = begin + file.size();
+
+		// Split the file in line-aligned chunks
+		auto& jobs = JobSystem::instance();
+		const auto maxChunks = (size_t)jobs.workerCount() + 1;
+		const auto chunkCount = std::max<size_t>(1, std::min<size_t>(maxChunks, file.size() / minChunkSize));
+		std::vector<const char*> bounds = { begin };
+		for (size_t i = 1; i < chunkCount; ++i) {
+			auto split = std::max(begin + file.size() * i / chunkCount, bounds.back());
+			bounds.push_back(split < end ? skipLine(split, end) : end);
+		}
+		bounds.push_back(end);
+
+		std::vector<Chunk> chunks(chunkCount);
+		auto runParallel = [&](const std::function<void(size_t)>& task) {
+			jobs.parallelFor(0, (int)chunkCount, 1, [&](int first, int last) {
+				for (auto i = first; i < last; ++i) {
+					task((size_t)i);
+				}
+			});
+		};
+
+		runParallel([&](size_t i) {
+			parse(bounds[i], bounds[i + 1], chunks[i]);
+		});
+
+		// Rebase indices on the element counts of previous chunks
+		for (size_t i = 1; i < chunkCount; ++i) {
+			auto& previous = chunks[i - 1];
+			chunks[i].positionOffset = previous.positionOffset + (int)previous.positions.size();
+			chunks[i].uvOffset = previous.uvOffset + (int)previous.uvs.size();
+			chunks[i].normalOffset = previous.normalOffset + (int)previous.normals.size();
+			chunks[i].vertexOffset = previous.vertexOffset + previous.corners.size();
+		}
+
+		std::vector<zmath::Vector3> positions;
+		std::vector<zmath::Vector2> uvs;
+		std::vector<zmath::Vector3> normals;
+		positions.reserve((size_t)chunks.back().positionOffset + chunks.back().positions.size());
+		uvs.reserve((size_t)chunks.back().uvOffset + chunks.back().uvs.size());
+		normals.reserve((size_t)chunks.back().normalOffset + chunks.back().normals.size());
+		for (auto& chunk : chunks) {
+			positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+			uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+			normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+		}
+
+		std::vector<Vertex> vertices(chunks.back().vertexOffset + chunks.back().corners.size());
+		runParallel([&](size_t i) {
+			auto& chunk = chunks[i];
+			for (auto& relative : chunk.relativeCorners) {
+				auto& corner = chunk.corners[relative.corner];
+				if (relative.flags & RelativeVertex) {
+					corner.vertex += chunk.positionOffset;
+				}
+				if (relative.flags & RelativeUv) {
+					corner.uv += chunk.uvOffset;
+				}
+				if (relative.flags & RelativeNormal) {
+					corner.normal += chunk.normalOffset;
+				}
+			}
+			build(chunk, positions, uvs, normals, vertices.data() + chunk.vertexOffset);
+		});
+
+		return new Vertexbuffer(std::move(vertices));
+	}
+}
@@ -1,16 +1,54 @@
 
 #include "pch.h"
 #include "phong_material.h"
-#include "entity.h"
-#include "transform.h"
-#include "light.h"
+#include "shading_frame.h"
 #include "ray.h"
-#include "visual.h"
-#include "triangle.h"
 #include "collision.h"
+#include "fast_math.h"
 
 namespace platz {
 
+	namespace phong {
+
+		//! x^exponent by repeated multiplication, unrolled at compile time
+		template <int exponent>
+		inline float power(float x) {
+			if constexpr (exponent == 0) {
+				return 1.f;
+			} else if constexpr (exponent == 1) {
+				return x;
+			} else {
+				const auto half = power<exponent / 2>(x);
+				return (exponent & 1) ? half * half * x : half * half;
+			}
+		}
+
+		//! x^exponent by squaring and multiplying
+		inline float power(float x, int exponent) {
+			auto result = 1.f;
+			while (exponent) {
+				if (exponent & 1) {
+					result *= x;
+				}
+				x *= x;
+				exponent >>= 1;
+			}
+			return result;
+		}
+
+		//! Largest exponent computed by multiplication
+		const float maxIntegerExponent = 1024.f;
+
+		//! Intensity of a point or spot light at a squared distance, cosAngle is between the light axis and the direction to the point
+		inline float localIntensity(const LightClusters::LocalLight& light, float distance2, float cosAngle) {
+			// Inverse square falloff, windowed to reach zero at the range
+			const auto ratio2 = distance2 * light.invRange2;
+			const auto window = std::max(1.f - ratio2 * ratio2, 0.f);
+			const auto cone = fastmath::saturate((cosAngle - light.cosOuter) * light.invConeRange);
+			return light.intensity * window * window / (distance2 + 1.f) * cone * cone;
+		}
+	}
+
 	PhongMaterial::PhongMaterial(
 		const Color& ambient, 
 		const std::shared_ptr<Texture>& diffuse, 
@@ -19,71 +57,399 @@ namespace platz {
 		: _ambient(ambient)
 		, _diffuse(diffuse)
 		, _specular(specular)
+		, _kernel(&PhongMaterial::shadeKernel<Albedo::Constant, false, false, RealExponent>)
 	{
 	}
 
-	Color PhongMaterial::shade(const ShadingContext& context, const Vertex& vertex) const {
-		Vector3 albedo = Vector3::zero;
-		if (auto diffuseTex = _diffuse.get()) {
-			const auto tx = (int)(vertex.uv.x * diffuseTex->width) % diffuseTex->width;
-			const auto ty = (int)(vertex.uv.y * diffuseTex->height) % diffuseTex->height;
-			const auto idx = ty * diffuseTex->width * diffuseTex->bpp + tx * diffuseTex->bpp;
-			albedo = {
-				(float)diffuseTex->data()[idx],
-				(float)diffuseTex->data()[idx + 1],
-				(float)diffuseTex->data()[idx + 2]				
-			};
+	PhongMaterial::PhongMaterial(
+		const Color& ambient,
+		const std::shared_ptr<VirtualTexture>& diffuse,
+		float specular
+	)
+		: _ambient(ambient)
+		, _virtualDiffuse(diffuse)
+		, _specular(specular)
+		, _kernel(&PhongMaterial::shadeKernel<Albedo::Constant, false, false, RealExponent>)
+	{
+	}
+
+	template <PhongMaterial::Albedo albedo, bool shadowed, bool singleLight>
+	PhongMaterial::Kernel PhongMaterial::selectKernel(float specular) {
+		if (specular == 16.f) {
+			return &PhongMaterial::shadeKernel<albedo, shadowed, singleLight, 16>;
+		}
+		if (specular == 32.f) {
+			return &PhongMaterial::shadeKernel<albedo, shadowed, singleLight, 32>;
+		}
+		if (specular == 64.f) {
+			return &PhongMaterial::shadeKernel<albedo, shadowed, singleLight, 64>;
+		}
+		if (specular >= 0.f && specular <= phong::maxIntegerExponent && specular == std::floor(specular)) {
+			return &PhongMaterial::shadeKernel<albedo, shadowed, singleLight, IntegerExponent>;
+		}
+		return &PhongMaterial::shadeKernel<albedo, shadowed, singleLight, RealExponent>;
+	}
+
+	template <PhongMaterial::Albedo albedo>
+	PhongMaterial::Kernel PhongMaterial::selectKernel(bool vertexLighting, bool shadowed, bool singleLight, float specular) {
+		if (vertexLighting) {
+			return &PhongMaterial::vertexKernel<albedo>;
+		}
+		if (shadowed) {
+			return singleLight ? selectKernel<albedo, true, true>(specular) : selectKernel<albedo, true, false>(specular);
+		}
+		return singleLight ? selectKernel<albedo, false, true>(specular) : selectKernel<albedo, false, false>(specular);
+	}
+
+	void PhongMaterial::prepare(const ShadingContext& context) {
+		auto albedo = Albedo::Constant;
+		_constantAlbedo = Color::black;
+		if (_diffuse) {
+			_diffuse->touch();
+			// Evictions only happen between frames, a ready texture stays ready for the whole draw
+			if (_diffuse->ready() && _diffuse->data()) {
+				albedo = Albedo::Texture;
+			} else {
+				_constantAlbedo = { .5f, .5f, .5f };
+			}
+		} else if (_virtualDiffuse) {
+			if (_virtualDiffuse->ready() && _virtualDiffuse->data()) {
+				albedo = Albedo::VirtualTexture;
+			} else {
+				_constantAlbedo = { .5f, .5f, .5f };
+			}
 		}
 
-		Vector3 diffuse = Vector3::zero;
+		const auto lightCount = context.frame.directionalCount();
+		const auto shadowed = context.receiveShadows && lightCount > 0;
+		const auto singleLight = lightCount == 1;
+		switch (albedo) {
+		case Albedo::Texture:
+			_kernel = selectKernel<Albedo::Texture>(context.vertexLighting, shadowed, singleLight, _specular);
+			break;
+		case Albedo::VirtualTexture:
+			_kernel = selectKernel<Albedo::VirtualTexture>(context.vertexLighting, shadowed, singleLight, _specular);
+			break;
+		default:
+			_kernel = selectKernel<Albedo::Constant>(context.vertexLighting, shadowed, singleLight, _specular);
+			break;
+		}
+	}
+
+	Color PhongMaterial::shade(const ShadingContext& context, const Vertex& vertex, const UVDerivatives& derivatives) const {
+		// Shade a quad made of the same pixel
+		Fragments fragments;
+		fragments.mask = 1;
+		fragments.x = -1;
+		fragments.y = -1;
+		fragments.derivatives = derivatives;
+		for (int i = 0; i < Fragments::count; ++i) {
+			fragments.positionX[i] = vertex.position.x;
+			fragments.positionY[i] = vertex.position.y;
+			fragments.positionZ[i] = vertex.position.z;
+			fragments.normalX[i] = vertex.normal.x;
+			fragments.normalY[i] = vertex.normal.y;
+			fragments.normalZ[i] = vertex.normal.z;
+			fragments.u[i] = vertex.uv.x;
+			fragments.v[i] = vertex.uv.y;
+			fragments.colorR[i] = vertex.color.r;
+			fragments.colorG[i] = vertex.color.g;
+			fragments.colorB[i] = vertex.color.b;
+			fragments.lightDiffuse[i] = vertex.lighting.x;
+			fragments.lightSpecular[i] = vertex.lighting.y;
+			fragments.lightAmbient[i] = vertex.lighting.z;
+		}
+
+		Color4 out;
+		shadeQuad(context, fragments, out);
+		return out[0];
+	}
+
+	void PhongMaterial::shadeQuad(const ShadingContext& context, const Fragments& fragments, Color4& out) const {
+		(this->*_kernel)(context, fragments, out);
+	}
+
+	void PhongMaterial::lightVertex(const ShadingContext& context, Vertex& vertex) const {
+		auto& frame = context.frame;
+		const auto position = vertex.position.xyz;
+		const auto normal = vertex.normal.normalized();
+		auto view = frame.cameraPos - position;
+		const auto viewLength2 = view.dot(view);
+		view = viewLength2 > 0.f ? view / std::sqrt(viewLength2) : zmath::Vector3::zero;
+
+		const auto integerExponent = _specular >= 0.f && _specular <= phong::maxIntegerExponent && _specular == std::floor(_specular);
+		auto specularPower = [&](float x) {
+			return integerExponent ? phong::power(x, (int)_specular) : fastmath::pow(x, _specular);
+		};
+
+		auto diffuse = 0.f;
 		auto specular = 0.f;
 		auto lightFactor = 1.f;
-		auto viewDir = (context.cameraPos - vertex.position.xyz).normalized();
-		for (auto& light : context.lights) {
-			auto lightDir = light->entity()->getComponent<Transform>()->forward();
-			diffuse = diffuse + albedo * light->intensity * std::max(-lightDir.dot(vertex.normal), 0.f);
+		const auto lightCount = frame.directionalCount();
+		for (int light = 0; light < lightCount; ++light) {
+			const auto lightDir = zmath::Vector3(frame.lightDirX[light], frame.lightDirY[light], frame.lightDirZ[light]);
+			const auto intensity = frame.lightIntensity[light];
+			const auto nDotL = lightDir.dot(normal);
+			diffuse += intensity * std::max(-nDotL, 0.f);
+			const auto reflected = lightDir - normal * (2.f * nDotL);
+			specular += intensity * specularPower(std::max(0.f, reflected.dot(view)));
+			if (context.receiveShadows && inShadow(frame, position, normal, lightDir)) {
+				lightFactor -= 1.f / lightCount;
+			}
+		}
+		diffuse *= lightFactor;
+		specular *= lightFactor;
 
-			auto reflected = lightDir.reflect(vertex.normal);
-			specular = specular + light->intensity * std::pow(std::max(0.f, reflected.dot(viewDir)), _specular);
+		// Not worth a cluster lookup, the range test rejects most lights
+		for (auto& light : frame.clusters.localLights()) {
+			const auto toPosition = position - light.position;
+			const auto distance2 = toPosition.dot(toPosition);
+			if (distance2 * light.invRange2 >= 1.f || distance2 <= 0.f) {
+				continue;
+			}
+			const auto lightDir = toPosition / std::sqrt(distance2);
+			const auto intensity = phong::localIntensity(light, distance2, lightDir.dot(light.direction));
+			const auto nDotL = lightDir.dot(normal);
+			diffuse += intensity * std::max(-nDotL, 0.f);
+			const auto reflected = lightDir - normal * (2.f * nDotL);
+			specular += intensity * specularPower(std::max(0.f, reflected.dot(view)));
+		}
 
-			if (context.receiveShadows) {
-				auto inShadow = false;
+		vertex.lighting = zmath::Vector3(diffuse, specular, lightFactor);
+	}
 
-				// Cast a ray towards the light
-				// Start the ray a little bit outside the surface to avoid collisions with self
-				auto surfacePos = vertex.position.xyz + vertex.normal * .01f;
-				zmath::Ray ray(surfacePos, -lightDir);
+	template <PhongMaterial::Albedo albedo>
+	void PhongMaterial::sampleAlbedo(const Fragments& fragments, Color4& albedoColor) const {
+		const auto count = Fragments::count;
+		if constexpr (albedo == Albedo::Texture) {
+			sampler.sample4(*_diffuse, fragments.u, fragments.v, _diffuse->lod(fragments.derivatives), albedoColor);
+		} else if constexpr (albedo == Albedo::VirtualTexture) {
+			const auto lod = _virtualDiffuse->lod(fragments.derivatives);
+			for (int i = 0; i < count; ++i) {
+				if (fragments.mask & (1 << i)) {
+					albedoColor.set(i, sampler.sample(*_virtualDiffuse, { fragments.u[i], fragments.v[i] }, lod));
+				}
+			}
+		} else {
+			for (int i = 0; i < count; ++i) {
+				albedoColor.set(i, _constantAlbedo);
+			}
+		}
+	}
+
+	template <PhongMaterial::Albedo albedo>
+	void PhongMaterial::vertexKernel(const ShadingContext& context, const Fragments& fragments, Color4& out) const {
+		Color4 albedoColor;
+		sampleAlbedo<albedo>(fragments, albedoColor);
+		for (int i = 0; i < Fragments::count; ++i) {
+			out.r[i] = _ambient.r * fragments.lightAmbient[i] + albedoColor.r[i] * fragments.lightDiffuse[i] + fragments.lightSpecular[i];
+			out.g[i] = _ambient.g * fragments.lightAmbient[i] + albedoColor.g[i] * fragments.lightDiffuse[i] + fragments.lightSpecular[i];
+			out.b[i] = _ambient.b * fragments.lightAmbient[i] + albedoColor.b[i] * fragments.lightDiffuse[i] + fragments.lightSpecular[i];
+			out.a[i] = 1.f;
+		}
+		fastmath::saturate(out.r, out.r);
+		fastmath::saturate(out.g, out.g);
+		fastmath::saturate(out.b, out.b);
+	}
+
+	template <PhongMaterial::Albedo albedo, bool shadowed, bool singleLight, int exponent>
+	void PhongMaterial::shadeKernel(const ShadingContext& context, const Fragments& fragments, Color4& out) const {
+		const auto count = Fragments::count;
 
-				// Loop through shadow casters
-				for (auto& visual : context.visuals) {
-					if (!visual->castShadows) {
+		Color4 albedoColor;
+		sampleAlbedo<albedo>(fragments, albedoColor);
+
+		auto& frame = context.frame;
+		alignas(16) float viewX[count];
+		alignas(16) float viewY[count];
+		alignas(16) float viewZ[count];
+		for (int i = 0; i < count; ++i) {
+			viewX[i] = frame.cameraPos.x - fragments.positionX[i];
+			viewY[i] = frame.cameraPos.y - fragments.positionY[i];
+			viewZ[i] = frame.cameraPos.z - fragments.positionZ[i];
+		}
+		fastmath::normalize(viewX, viewY, viewZ);
+
+		alignas(16) float diffuseR[count] = {};
+		alignas(16) float diffuseG[count] = {};
+		alignas(16) float diffuseB[count] = {};
+		alignas(16) float specular[count] = {};
+		alignas(16) float lightFactor[count] = { 1.f, 1.f, 1.f, 1.f };
+		const auto integerExponent = (int)_specular;
+
+		// Raises the 4 lanes to the specular exponent
+		auto specularPower = [&](float* x) {
+			if constexpr (exponent > 0) {
+				for (int i = 0; i < count; ++i) {
+					x[i] = phong::power<exponent>(x[i]);
+				}
+			} else if constexpr (exponent == IntegerExponent) {
+				for (int i = 0; i < count; ++i) {
+					x[i] = phong::power(x[i], integerExponent);
+				}
+			} else {
+				fastmath::pow(x, _specular, x);
+			}
+		};
+
+		auto addLight = [&](int light, float shadowWeight) {
+			const auto lightDir = zmath::Vector3(frame.lightDirX[light], frame.lightDirY[light], frame.lightDirZ[light]);
+			const auto intensity = frame.lightIntensity[light];
+			alignas(16) float highlight[count];
+			for (int i = 0; i < count; ++i) {
+				const auto nDotL = lightDir.x * fragments.normalX[i] + lightDir.y * fragments.normalY[i] + lightDir.z * fragments.normalZ[i];
+				const auto diffuse = intensity * std::max(-nDotL, 0.f);
+				diffuseR[i] += albedoColor.r[i] * diffuse;
+				diffuseG[i] += albedoColor.g[i] * diffuse;
+				diffuseB[i] += albedoColor.b[i] * diffuse;
+
+				// Light direction reflected on the surface
+				const auto reflectedX = lightDir.x - 2.f * nDotL * fragments.normalX[i];
+				const auto reflectedY = lightDir.y - 2.f * nDotL * fragments.normalY[i];
+				const auto reflectedZ = lightDir.z - 2.f * nDotL * fragments.normalZ[i];
+				highlight[i] = std::max(0.f, reflectedX * viewX[i] + reflectedY * viewY[i] + reflectedZ * viewZ[i]);
+			}
+			specularPower(highlight);
+			for (int i = 0; i < count; ++i) {
+				specular[i] += intensity * highlight[i];
+			}
+
+			if constexpr (shadowed) {
+				for (int i = 0; i < count; ++i) {
+					if (!(fragments.mask & (1 << i))) {
 						continue;
 					}
-					auto vb = visual->geometry->getVertexBuffer();
-					auto transform = visual->entity()->getComponent<Transform>();
-					for (int i = 0; i < vb->vertices.size(); i += 3) {
-						Triangle triangle(
-							transform->worldMatrix() * vb->vertices[i].position.xyz,
-							transform->worldMatrix() * vb->vertices[i + 1].position.xyz,
-							transform->worldMatrix() * vb->vertices[i + 2].position.xyz
-						);
-						Collision::RayTriangleResult result;
-						if (Collision::rayTriangle(ray, triangle, result)) {
-							// Remove the influence of this light
-							lightFactor -= 1.f / context.lights.size();
-							inShadow = true;
-							break;
-						}
+					const auto position = zmath::Vector3(fragments.positionX[i], fragments.positionY[i], fragments.positionZ[i]);
+					const auto normal = zmath::Vector3(fragments.normalX[i], fragments.normalY[i], fragments.normalZ[i]);
+					if (inShadow(frame, position, normal, lightDir)) {
+						// Remove the influence of this light
+						lightFactor[i] -= shadowWeight;
 					}
-					if (inShadow) {
-						break;
+				}
+			}
+		};
+
+		if constexpr (singleLight) {
+			addLight(0, 1.f);
+		} else {
+			const auto lightCount = frame.directionalCount();
+			const auto shadowWeight = lightCount == 0 ? 0.f : 1.f / lightCount;
+			for (int light = 0; light < lightCount; ++light) {
+				addLight(light, shadowWeight);
+			}
+		}
+
+		// Point and spot lights do not cast shadows, they are added after the shadow factor
+		alignas(16) float localR[count] = {};
+		alignas(16) float localG[count] = {};
+		alignas(16) float localB[count] = {};
+
+		auto addLocalLight = [&](const LightClusters::LocalLight& light) {
+			// From the light to the surface
+			alignas(16) float lightDirX[count];
+			alignas(16) float lightDirY[count];
+			alignas(16) float lightDirZ[count];
+			alignas(16) float distance2[count];
+			auto inRange = false;
+			for (int i = 0; i < count; ++i) {
+				lightDirX[i] = fragments.positionX[i] - light.position.x;
+				lightDirY[i] = fragments.positionY[i] - light.position.y;
+				lightDirZ[i] = fragments.positionZ[i] - light.position.z;
+				distance2[i] = lightDirX[i] * lightDirX[i] + lightDirY[i] * lightDirY[i] + lightDirZ[i] * lightDirZ[i];
+				inRange |= distance2[i] * light.invRange2 < 1.f;
+			}
+			if (!inRange) {
+				return;
+			}
+			fastmath::normalize(lightDirX, lightDirY, lightDirZ);
+
+			alignas(16) float intensity[count];
+			alignas(16) float nDotL[count];
+			alignas(16) float highlight[count];
+			for (int i = 0; i < count; ++i) {
+				const auto cosAngle = lightDirX[i] * light.direction.x + lightDirY[i] * light.direction.y + lightDirZ[i] * light.direction.z;
+				intensity[i] = phong::localIntensity(light, distance2[i], cosAngle);
+
+				nDotL[i] = lightDirX[i] * fragments.normalX[i] + lightDirY[i] * fragments.normalY[i] + lightDirZ[i] * fragments.normalZ[i];
+				const auto reflectedX = lightDirX[i] - 2.f * nDotL[i] * fragments.normalX[i];
+				const auto reflectedY = lightDirY[i] - 2.f * nDotL[i] * fragments.normalY[i];
+				const auto reflectedZ = lightDirZ[i] - 2.f * nDotL[i] * fragments.normalZ[i];
+				highlight[i] = std::max(0.f, reflectedX * viewX[i] + reflectedY * viewY[i] + reflectedZ * viewZ[i]);
+			}
+			specularPower(highlight);
+			for (int i = 0; i < count; ++i) {
+				const auto diffuse = intensity[i] * std::max(-nDotL[i], 0.f);
+				localR[i] += albedoColor.r[i] * diffuse + intensity[i] * highlight[i];
+				localG[i] += albedoColor.g[i] * diffuse + intensity[i] * highlight[i];
+				localB[i] += albedoColor.b[i] * diffuse + intensity[i] * highlight[i];
+			}
+		};
+
+		if (!frame.clusters.localLights().empty()) {
+			auto& clusters = frame.clusters;
+			auto& localLights = clusters.localLights();
+			if (fragments.x < 0) {
+				for (auto& light : localLights) {
+					addLocalLight(light);
+				}
+			} else {
+				// Pixels of a quad share a tile but can be in different depth slices
+				int quadClusters[count];
+				auto clusterCount = 0;
+				for (int i = 0; i < count; ++i) {
+					if (!(fragments.mask & (1 << i))) {
+						continue;
+					}
+					const auto depth = clusters.depth(fragments.positionX[i], fragments.positionY[i], fragments.positionZ[i]);
+					const auto cluster = clusters.cluster(fragments.x + (i & 1), fragments.y + (i >> 1), depth);
+					if (std::find(quadClusters, quadClusters + clusterCount, cluster) == quadClusters + clusterCount) {
+						quadClusters[clusterCount++] = cluster;
 					}
 				}
+				for (int c = 0; c < clusterCount; ++c) {
+					for (auto index = clusters.begin(quadClusters[c]); index != clusters.end(quadClusters[c]); ++index) {
+						// Skip the lights already added from a previous cluster
+						auto added = false;
+						for (int previous = 0; previous < c && !added; ++previous) {
+							added = std::binary_search(clusters.begin(quadClusters[previous]), clusters.end(quadClusters[previous]), *index);
+						}
+						if (!added) {
+							addLocalLight(localLights[*index]);
+						}
+					}
+				}
+			}
+		}
+
+		for (int i = 0; i < count; ++i) {
+			if constexpr (shadowed) {
+				out.r[i] = std::min(_ambient.r + diffuseR[i] + specular[i], 1.f) * lightFactor[i] + localR[i];
+				out.g[i] = std::min(_ambient.g + diffuseG[i] + specular[i], 1.f) * lightFactor[i] + localG[i];
+				out.b[i] = std::min(_ambient.b + diffuseB[i] + specular[i], 1.f) * lightFactor[i] + localB[i];
+			} else {
+				out.r[i] = _ambient.r + diffuseR[i] + specular[i] + localR[i];
+				out.g[i] = _ambient.g + diffuseG[i] + specular[i] + localG[i];
+				out.b[i] = _ambient.b + diffuseB[i] + specular[i] + localB[i];
+			}
+			out.a[i] = 1.f;
+		}
+		// Terms are positive, so clamping the sum matches clamping each addition
+		fastmath::saturate(out.r, out.r);
+		fastmath::saturate(out.g, out.g);
+		fastmath::saturate(out.b, out.b);
+	}
+
+	bool PhongMaterial::inShadow(const ShadingFrame& frame, const zmath::Vector3& position, const zmath::Vector3& normal, const zmath::Vector3& lightDir) const {
+		// Start the ray a little bit outside the surface to avoid collisions with self
+		auto surfacePos = position + normal * .01f;
+		zmath::Ray ray(surfacePos, -lightDir);
+
+		for (auto& triangle : frame.shadowCasters) {
+			zmath::Collision::RayTriangleResult result;
+			if (zmath::Collision::rayTriangle(ray, triangle, result)) {
+				return true;
 			}
 		}
-		
-		auto _diffuse = diffuse / 255.f;
-		auto color = _ambient + Color(_diffuse.x, _diffuse.y, _diffuse.z) + Color::white * specular;
-		return color * lightFactor;
+		return false;
 	}
 }
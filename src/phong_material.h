@@ -3,24 +3,82 @@
 
 #include "material.h"
 #include "texture.h"
+#include "sampler.h"
+#include "virtual_texture.h"
 
 namespace platz {
+	//! The shading kernel is specialized at compile time on the albedo source, shadows, directional light count
+	//! and specular exponent, and picked once per draw by prepare().
+	//! Lit per vertex, draws only apply the interpolated light terms to the albedo.
 	class PhongMaterial : public Material  {
 	public:		
 
+		//! Used to read the diffuse texture
+		Sampler sampler;
+
 		PhongMaterial(
 			const Color& ambient, 
 			const std::shared_ptr<Texture>& diffuse = nullptr, 
 			float specular = 2.f
 		);
 
-		virtual Color shade(const ShadingContext& context, const Vertex& vertex) const override;
+		PhongMaterial(
+			const Color& ambient,
+			const std::shared_ptr<VirtualTexture>& diffuse,
+			float specular = 2.f
+		);
+
+		virtual void prepare(const ShadingContext& context) override;
+		virtual Color shade(const ShadingContext& context, const Vertex& vertex, const UVDerivatives& derivatives) const override;
+		virtual void shadeQuad(const ShadingContext& context, const Fragments& fragments, Color4& out) const override;
+
+		virtual bool supportsVertexLighting() const override { return true; }
+		virtual void lightVertex(const ShadingContext& context, Vertex& vertex) const override;
 
 	private:
 
+		enum class Albedo {
+			//! Untextured, or a placeholder while the texture loads
+			Constant,
+			Texture,
+			VirtualTexture
+		};
+
+		//! Kernel exponent for integer exponents not known at compile time
+		static const int IntegerExponent = 0;
+
+		//! Kernel exponent for fractional exponents, using std::pow
+		static const int RealExponent = -1;
+
+		using Kernel = void (PhongMaterial::*)(const ShadingContext&, const Fragments&, Color4&) const;
+
+		template <Albedo albedo, bool shadowed, bool singleLight, int exponent>
+		void shadeKernel(const ShadingContext& context, const Fragments& fragments, Color4& out) const;
+
+		template <Albedo albedo, bool shadowed, bool singleLight>
+		static Kernel selectKernel(float specular);
+
+		template <Albedo albedo>
+		static Kernel selectKernel(bool vertexLighting, bool shadowed, bool singleLight, float specular);
+
+		//! Applies the light terms interpolated from lightVertex()
+		template <Albedo albedo>
+		void vertexKernel(const ShadingContext& context, const Fragments& fragments, Color4& out) const;
+
+		template <Albedo albedo>
+		void sampleAlbedo(const Fragments& fragments, Color4& albedoColor) const;
+
+		//! Casts a ray from the surface towards the light, against the shadow casters of the frame
+		bool inShadow(const ShadingFrame& frame, const zmath::Vector3& position, const zmath::Vector3& normal, const zmath::Vector3& lightDir) const;
+
 		Color _ambient;		
 		std::shared_ptr<Texture> _diffuse;
+		std::shared_ptr<VirtualTexture> _virtualDiffuse;
 		float _specular = 2.f;
+
+		//! Selected by prepare()
+		Kernel _kernel;
+		Color _constantAlbedo = Color::black;
 	};
 }
 
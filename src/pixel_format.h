@@ -0,0 +1,16 @@
+#pragma once
+
+namespace platz {
+
+	//! Storage format of canvas pixels, chosen per canvas
+	enum class PixelFormat {
+		//! 32 bits per pixel, bytes in R, G, B, A order
+		RGBA8,
+		//! 32 bits per pixel, bytes in B, G, R, A order, the layout display drivers use natively
+		BGRA8,
+		//! 16 bits per pixel, red in the high bits
+		RGB565,
+		//! 4 floats per pixel, not clamped above 1
+		RGBA32F
+	};
+}
@@ -1,6 +1,7 @@
 
 #include "pch.h"
 #include "png_loader.h"
+#include "mapped_file.h"
 #include <assert.h>
 
 #include "png.h"
@@ -18,17 +19,47 @@ namespace platz {
 			delete[](unsigned char*)ptr;
 		}
 
+		struct Source {
+			const unsigned char* data;
+			size_t size;
+			size_t offset;
+		};
+
 		//! PNG read
 		void png_read(png_structp png_ptr, png_bytep data, png_size_t length) {
-			auto fp = (FILE*)png_get_io_ptr(png_ptr);
-			fread(data, 1, length, fp);
+			auto source = (Source*)png_get_io_ptr(png_ptr);
+			if (length > source->size - source->offset) {
+				png_error(png_ptr, "Unexpected end of file");
+			}
+			memcpy(data, source->data + source->offset, length);
+			source->offset += length;
+		}
+	}
+
+	bool PNGLoader::load(const std::string& path, const Allocator& allocate) {
+		MappedFile file(path);
+		if (!file.valid()) {
+			return false;
 		}
+		return load(reinterpret_cast<const unsigned char*>(file.data()), file.size(), allocate);
+	}
+
+	bool PNGLoader::load(const unsigned char* data, size_t size, const Allocator& allocate) {
+		return decode(data, size, 0, allocate, nullptr);
+	}
+
+	bool PNGLoader::load(const unsigned char* data, size_t size, int stripHeight, const StripReader& read) {
+		std::unique_ptr<unsigned char[]> strip;
+		auto allocate = [&](int width, int rows) {
+			strip.reset(new unsigned char[(size_t)width * rows * 4]);
+			return strip.get();
+		};
+		return decode(data, size, stripHeight, allocate, &read);
 	}
 
-	unsigned char* PNGLoader::load(const std::string& path, int& width, int& height, int& channels) {
-		auto fp = fopen(path.c_str(), "rb");
-		if (!fp) {
-			return NULL;
+	bool PNGLoader::decode(const unsigned char* data, size_t size, int stripHeight, const Allocator& allocate, const StripReader* read) {
+		if (size < 8 || png_sig_cmp(data, 0, 8) != 0) {
+			return false;
 		}
 
 		png_structp png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
@@ -44,41 +75,55 @@ namespace platz {
 		png_infop info_ptr = png_create_info_struct(png_ptr);
 		assert(info_ptr);
 
-		png_set_read_fn(png_ptr, fp, pngloader::png_read);
-
-		int sig_read = 0;
-		png_set_sig_bytes(png_ptr, sig_read);
-
-		png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_PACKING | PNG_TRANSFORM_EXPAND, NULL);
+		if (setjmp(png_jmpbuf(png_ptr))) {
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			return false;
+		}
 
-		width = info_ptr->width;
-		height = info_ptr->height;
+		pngloader::Source source = { data, size, 0 };
+		png_set_read_fn(png_ptr, &source, pngloader::png_read);
+		png_read_info(png_ptr, info_ptr);
 
-		switch (info_ptr->color_type) {
-		case PNG_COLOR_TYPE_RGBA:
-			channels = 4;
-			break;
+		const int width = png_get_image_width(png_ptr, info_ptr);
+		const int height = png_get_image_height(png_ptr, info_ptr);
+		const auto colorType = png_get_color_type(png_ptr, info_ptr);
 
-		case PNG_COLOR_TYPE_RGB:
-			channels = 3;
-			break;
-		default: assert(false);
+		// Convert everything to RGBA8 while decoding
+		png_set_expand(png_ptr);
+		png_set_strip_16(png_ptr);
+		png_set_packing(png_ptr);
+		if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA) {
+			png_set_gray_to_rgb(png_ptr);
+		}
+		if (!(colorType & PNG_COLOR_MASK_ALPHA) && !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+			png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
 		}
+		const auto passes = png_set_interlace_handling(png_ptr);
+		png_read_update_info(png_ptr, info_ptr);
 
-		auto row_bytes = png_get_rowbytes(png_ptr, info_ptr);
+		const auto rowBytes = png_get_rowbytes(png_ptr, info_ptr);
+		assert(rowBytes == (size_t)width * 4);
 
-		assert(row_bytes == width * channels);
-		png_bytepp row_pointers = png_get_rows(png_ptr, info_ptr);
+		const auto rows = read && passes == 1 ? std::min(stripHeight, height) : height;
+		auto pixels = allocate(width, rows);
+		if (!pixels) {
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			return false;
+		}
 
-		auto pngData = new unsigned char[row_bytes * height];
-		for (int i = 0; i < height; ++i) {
-			memcpy(pngData + (row_bytes * i), row_pointers[i], row_bytes);
+		// libpng writes each row straight into the destination, interlaced images are combined in place
+		for (int pass = 0; pass < passes; ++pass) {
+			for (int i = 0; i < height; ++i) {
+				png_read_row(png_ptr, pixels + rowBytes * (i % rows), NULL);
+				if (read && pass == passes - 1 && ((i + 1) % rows == 0 || i + 1 == height)) {
+					const auto y = i / rows * rows;
+					(*read)(pixels, width, height, y, i + 1 - y);
+				}
+			}
 		}
 
+		png_read_end(png_ptr, NULL);
 		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-
-		fclose(fp);
-		return pngData;
+		return true;
 	}
 }
-
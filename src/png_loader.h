@@ -2,10 +2,33 @@
 #pragma once
 
 #include <string>
+#include <functional>
 
 namespace platz {
 	class PNGLoader {
 	public:
-		static unsigned char* load(const std::string& path, int& width, int& height, int& channels);
+
+		//! Called once the image size is known.
+		//! Must return storage for width * height RGBA8 pixels, rows are written in place.
+		using Allocator = std::function<unsigned char*(int width, int height)>;
+
+		//! Receives consecutive rows starting at row y, RGBA8 and tightly packed.
+		//! The storage belongs to the loader and is reused for the next strip.
+		using StripReader = std::function<void(const unsigned char* pixels, int width, int height, int y, int rows)>;
+
+		//! Decodes into RGBA8, converting from any PNG color type
+		static bool load(const std::string& path, const Allocator& allocate);
+		static bool load(const unsigned char* data, size_t size, const Allocator& allocate);
+
+		//! Decodes stripHeight rows at a time, so that only one strip is held in memory.
+		//! Strips start at multiples of stripHeight, only the last one can be shorter.
+		//! Interlaced images are only complete after the last pass, they are passed on as a single strip.
+		static bool load(const unsigned char* data, size_t size, int stripHeight, const StripReader& read);
+
+	private:
+
+		//! Decodes into storage for the whole image, or for one strip at a time when read is given.
+		//! Storage comes from allocate() so that nothing is left to clean up after a longjmp from libpng.
+		static bool decode(const unsigned char* data, size_t size, int stripHeight, const Allocator& allocate, const StripReader* read);
 	};	
 }
@@ -0,0 +1,302 @@
+
+#include "pch.h"
+#include "sampler.h"
+#include "texture.h"
+#include "virtual_texture.h"
+
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define PLATZ_SAMPLER_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#endif
+
+namespace platz {
+
+	namespace sampler {
+
+		const float inv255 = 1.f / 255.f;
+
+		//! Bilinear taps along one axis
+		struct Taps {
+			int i0;
+			int i1;
+			float t;
+		};
+
+		//! Folds a coordinate into [0, 1], reflecting every other repetition
+		inline float mirror(float coord) {
+			coord -= 2.f * std::floor(coord * .5f);
+			return coord > 1.f ? 2.f - coord : coord;
+		}
+
+		//! Lanes extrapolated past a triangle edge can divide by a w close to 0.
+		//! NaN and infinite coordinates would convert to INT_MIN, so they read texel 0 instead.
+		inline float finite(float coord) {
+			return std::isfinite(coord) ? coord : 0.f;
+		}
+
+		inline int nearest(Sampler::Address mode, float coord, int size, bool pow2) {
+			coord = finite(coord);
+			switch (mode) {
+			case Sampler::Address::Wrap:
+				if (pow2) {
+					return (int)std::floor(coord * size) & (size - 1);
+				}
+				coord -= std::floor(coord);
+				return std::min((int)(coord * size), size - 1);
+
+			case Sampler::Address::Mirror:
+				coord = mirror(coord);
+				break;
+
+			default:
+				break;
+			}
+			return (int)std::min(std::max(coord * size, 0.f), (float)(size - 1));
+		}
+
+		inline Taps bilinear(Sampler::Address mode, float coord, int size, bool pow2) {
+			coord = finite(coord);
+			if (mode == Sampler::Address::Mirror) {
+				coord = mirror(coord);
+			} else if (mode == Sampler::Address::Wrap && !pow2) {
+				coord -= std::floor(coord);
+			}
+
+			auto x = coord * size - .5f;
+			if (mode != Sampler::Address::Wrap) {
+				x = std::min(std::max(x, -1.f), (float)size);
+			}
+			const auto fx = std::floor(x);
+			const auto i = (int)fx;
+
+			Taps taps;
+			taps.t = x - fx;
+			if (mode != Sampler::Address::Wrap) {
+				taps.i0 = std::min(std::max(i, 0), size - 1);
+				taps.i1 = std::min(std::max(i + 1, 0), size - 1);
+			} else if (pow2) {
+				taps.i0 = i & (size - 1);
+				taps.i1 = (i + 1) & (size - 1);
+			} else {
+				// The coordinate is in [0, 1], so i is in [-1, size - 1]
+				taps.i0 = i < 0 ? size - 1 : i;
+				taps.i1 = i + 1 < size ? i + 1 : 0;
+			}
+			return taps;
+		}
+
+		inline Color unpack(uint32_t texel) {
+			return Color(
+				(float)(texel & 0xff) * inv255,
+				(float)((texel >> 8) & 0xff) * inv255,
+				(float)((texel >> 16) & 0xff) * inv255,
+				(float)(texel >> 24) * inv255
+			);
+		}
+
+		//! Picks the mip levels to read and the blend factor between them
+		inline void levels(Sampler::MipFilter filter, int mipCount, float lod, int& level0, int& level1, float& t) {
+			const auto maxLevel = mipCount - 1;
+			level0 = 0;
+			level1 = 0;
+			t = 0.f;
+			if (filter == Sampler::MipFilter::None || maxLevel == 0) {
+				return;
+			}
+			lod = std::min(std::max(lod, 0.f), (float)maxLevel);
+			if (filter == Sampler::MipFilter::Nearest) {
+				level0 = level1 = (int)(lod + .5f);
+				return;
+			}
+			level0 = (int)lod;
+			level1 = std::min(level0 + 1, maxLevel);
+			t = lod - level0;
+		}
+
+		//! Filters one level of size width x height, fetch(x, y) returns RGBA8 texels
+		template <typename Fetch>
+		Color filter(const Sampler& sampler, int width, int height, bool pow2, const zmath::Vector2& uv, const Fetch& fetch) {
+			if (sampler.filter == Sampler::Filter::Nearest) {
+				const auto x = nearest(sampler.addressU, uv.x, width, pow2);
+				const auto y = nearest(sampler.addressV, uv.y, height, pow2);
+				return unpack(fetch(x, y));
+			}
+
+			const auto tx = bilinear(sampler.addressU, uv.x, width, pow2);
+			const auto ty = bilinear(sampler.addressV, uv.y, height, pow2);
+			const auto a = unpack(fetch(tx.i0, ty.i0));
+			const auto b = unpack(fetch(tx.i1, ty.i0));
+			const auto c = unpack(fetch(tx.i0, ty.i1));
+			const auto d = unpack(fetch(tx.i1, ty.i1));
+			const auto top = a * (1.f - tx.t) + b * tx.t;
+			const auto bottom = c * (1.f - tx.t) + d * tx.t;
+			return top * (1.f - ty.t) + bottom * ty.t;
+		}
+
+		//! Texels are decoded from the storage format as they are fetched
+		template <Texture::Format format>
+		Color filterLevel(const Sampler& sampler, const Texture& texture, int level, const zmath::Vector2& uv) {
+			const auto& mip = texture.mip(level);
+			return filter(sampler, mip.width, mip.height, mip.pow2, uv, [&](int x, int y) {
+				return texture.fetch<format>(level, x, y);
+			});
+		}
+
+		Color filterLevel(const Sampler& sampler, const VirtualTexture& texture, int level, const zmath::Vector2& uv) {
+			const auto& l = texture.level(level);
+			return filter(sampler, l.width, l.height, l.pow2, uv, [&](int x, int y) {
+				return texture.fetch(level, x, y);
+			});
+		}
+
+#ifdef PLATZ_SAMPLER_SSE2
+		inline __m128 floor4(__m128 x) {
+			// Truncation rounds negative values up, step those back by one
+			const auto truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+			return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.f)));
+		}
+
+		//! Part of Texture::tiledIndex() depending on x
+		inline __m128i tiledColumn(__m128i x) {
+			return _mm_add_epi32(_mm_slli_epi32(_mm_srli_epi32(x, 2), 4), _mm_and_si128(x, _mm_set1_epi32(3)));
+		}
+
+		//! Part of Texture::tiledIndex() depending on y, shift is log2(tilesX * 16)
+		inline __m128i tiledRow(__m128i y, __m128i shift) {
+			return _mm_add_epi32(_mm_sll_epi32(_mm_srli_epi32(y, 2), shift), _mm_slli_epi32(_mm_and_si128(y, _mm_set1_epi32(3)), 2));
+		}
+
+		inline __m128i gather(const uint32_t* texels, __m128i indices) {
+#if defined(__AVX2__)
+			return _mm_i32gather_epi32(reinterpret_cast<const int*>(texels), indices, 4);
+#else
+			alignas(16) int32_t i[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(i), indices);
+			return _mm_set_epi32((int)texels[i[3]], (int)texels[i[2]], (int)texels[i[1]], (int)texels[i[0]]);
+#endif
+		}
+
+		template <int shift>
+		inline __m128 channel(__m128i texels) {
+			return _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, shift), _mm_set1_epi32(0xff)));
+		}
+
+		inline __m128 lerp(__m128 a, __m128 b, __m128 t) {
+			return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+		}
+
+		template <int shift>
+		inline void blend(__m128i a, __m128i b, __m128i c, __m128i d, __m128 tx, __m128 ty, float* out) {
+			const auto top = lerp(channel<shift>(a), channel<shift>(b), tx);
+			const auto bottom = lerp(channel<shift>(c), channel<shift>(d), tx);
+			_mm_store_ps(out, _mm_mul_ps(lerp(top, bottom, ty), _mm_set1_ps(inv255)));
+		}
+#endif
+	}
+
+	Color Sampler::sample(const Texture& texture, const zmath::Vector2& uv, float lod) const {
+		int level0, level1;
+		float t;
+		sampler::levels(mipFilter, texture.mipCount(), lod, level0, level1, t);
+
+		const auto color = sampleLevel(texture, level0, uv);
+		if (level0 == level1 || t <= 0.f) {
+			return color;
+		}
+		return color * (1.f - t) + sampleLevel(texture, level1, uv) * t;
+	}
+
+	Color Sampler::sample(const VirtualTexture& texture, const zmath::Vector2& uv, float lod) const {
+		int level0, level1;
+		float t;
+		sampler::levels(mipFilter, texture.levelCount(), lod, level0, level1, t);
+
+		const auto& level = texture.level(level0);
+		texture.request(
+			level0,
+			sampler::nearest(addressU, uv.x, level.width, level.pow2),
+			sampler::nearest(addressV, uv.y, level.height, level.pow2)
+		);
+
+		const auto color = sampler::filterLevel(*this, texture, level0, uv);
+		if (level0 == level1 || t <= 0.f) {
+			return color;
+		}
+		return color * (1.f - t) + sampler::filterLevel(*this, texture, level1, uv) * t;
+	}
+
+	void Sampler::sample4(const Texture& texture, const float u[4], const float v[4], float lod, Color4& out) const {
+		int level0, level1;
+		float t;
+		sampler::levels(mipFilter, texture.mipCount(), lod, level0, level1, t);
+
+		sampleLevel4(texture, level0, u, v, out);
+		if (level0 == level1 || t <= 0.f) {
+			return;
+		}
+
+		Color4 next;
+		sampleLevel4(texture, level1, u, v, next);
+		for (int i = 0; i < 4; ++i) {
+			out.r[i] += (next.r[i] - out.r[i]) * t;
+			out.g[i] += (next.g[i] - out.g[i]) * t;
+			out.b[i] += (next.b[i] - out.b[i]) * t;
+			out.a[i] += (next.a[i] - out.a[i]) * t;
+		}
+	}
+
+	Color Sampler::sampleLevel(const Texture& texture, int level, const zmath::Vector2& uv) const {
+		switch (texture.format()) {
+		case Texture::Format::RGB565: return sampler::filterLevel<Texture::Format::RGB565>(*this, texture, level, uv);
+		case Texture::Format::BC1: return sampler::filterLevel<Texture::Format::BC1>(*this, texture, level, uv);
+		default: return sampler::filterLevel<Texture::Format::RGBA8>(*this, texture, level, uv);
+		}
+	}
+
+	void Sampler::sampleLevel4(const Texture& texture, int level, const float u[4], const float v[4], Color4& out) const {
+		const auto& mip = texture.mip(level);
+
+#ifdef PLATZ_SAMPLER_SSE2
+		if (filter == Filter::Bilinear && addressU == Address::Wrap && addressV == Address::Wrap && mip.pow2 && texture.format() == Texture::Format::RGBA8) {
+			const auto x = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(u), _mm_set1_ps((float)mip.width)), _mm_set1_ps(.5f));
+			const auto y = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(v), _mm_set1_ps((float)mip.height)), _mm_set1_ps(.5f));
+			const auto fx = sampler::floor4(x);
+			const auto fy = sampler::floor4(y);
+			const auto tx = _mm_sub_ps(x, fx);
+			const auto ty = _mm_sub_ps(y, fy);
+
+			const auto ix = _mm_cvttps_epi32(fx);
+			const auto iy = _mm_cvttps_epi32(fy);
+			const auto one = _mm_set1_epi32(1);
+			const auto maskX = _mm_set1_epi32(mip.width - 1);
+			const auto maskY = _mm_set1_epi32(mip.height - 1);
+			const auto x0 = sampler::tiledColumn(_mm_and_si128(ix, maskX));
+			const auto x1 = sampler::tiledColumn(_mm_and_si128(_mm_add_epi32(ix, one), maskX));
+			const auto shift = _mm_cvtsi32_si128(mip.tilesXLog2 + 4);
+			const auto row0 = sampler::tiledRow(_mm_and_si128(iy, maskY), shift);
+			const auto row1 = sampler::tiledRow(_mm_and_si128(_mm_add_epi32(iy, one), maskY), shift);
+
+			const auto texels = texture.texels(level);
+			const auto a = sampler::gather(texels, _mm_add_epi32(row0, x0));
+			const auto b = sampler::gather(texels, _mm_add_epi32(row0, x1));
+			const auto c = sampler::gather(texels, _mm_add_epi32(row1, x0));
+			const auto d = sampler::gather(texels, _mm_add_epi32(row1, x1));
+
+			sampler::blend<0>(a, b, c, d, tx, ty, out.r);
+			sampler::blend<8>(a, b, c, d, tx, ty, out.g);
+			sampler::blend<16>(a, b, c, d, tx, ty, out.b);
+			sampler::blend<24>(a, b, c, d, tx, ty, out.a);
+			return;
+		}
+#endif
+
+		for (int i = 0; i < 4; ++i) {
+			out.set(i, sampleLevel(texture, level, { u[i], v[i] }));
+		}
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "color.h"
+#include "vector2.h"
+
+namespace platz {
+
+	class Texture;
+	class VirtualTexture;
+
+	//! How a texture is read: addressing outside of [0, 1] and filtering
+	class Sampler {
+	public:
+
+		enum class Address {
+			Wrap,
+			Clamp,
+			Mirror
+		};
+
+		enum class Filter {
+			Nearest,
+			Bilinear
+		};
+
+		enum class MipFilter {
+			//! Always sample the base level
+			None,
+			Nearest,
+			//! Blend the two closest levels (trilinear with Filter::Bilinear)
+			Linear
+		};
+
+		Address addressU = Address::Wrap;
+		Address addressV = Address::Wrap;
+		Filter filter = Filter::Bilinear;
+		MipFilter mipFilter = MipFilter::Linear;
+
+		Sampler() = default;
+		Sampler(Address address, Filter _filter = Filter::Bilinear, MipFilter _mipFilter = MipFilter::Linear)
+			: addressU(address)
+			, addressV(address)
+			, filter(_filter)
+			, mipFilter(_mipFilter) {
+
+		}
+
+		//! The texture must be ready and have data
+		Color sample(const Texture& texture, const zmath::Vector2& uv, float lod = 0.f) const;
+
+		//! Also records the pages read at the requested level, for streaming
+		Color sample(const VirtualTexture& texture, const zmath::Vector2& uv, float lod = 0.f) const;
+
+		//! Samples 4 coordinates sharing the same lod, typically a 2x2 pixel quad.
+		//! Wrapped bilinear reads of power-of-two RGBA8 textures are vectorized, other combinations fall back to sample().
+		void sample4(const Texture& texture, const float u[4], const float v[4], float lod, Color4& out) const;
+
+	private:
+
+		Color sampleLevel(const Texture& texture, int level, const zmath::Vector2& uv) const;
+
+		void sampleLevel4(const Texture& texture, int level, const float u[4], const float v[4], Color4& out) const;
+	};
+}
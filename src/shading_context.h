@@ -1,17 +1,15 @@
 #pragma once
 
-#include "vector3.h"
-#include <vector>
-
 namespace platz {
 
-	class Visual;
-	class Light;
+	class ShadingFrame;
 
 	struct ShadingContext {
-		zmath::Vector3 cameraPos;
-		const std::vector<Visual*>& visuals;
-		const std::vector<Light*>& lights;
+		//! Lights, camera and shadow casters of the frame
+		const ShadingFrame& frame;
 		bool receiveShadows;
+
+		//! Lighting is evaluated per vertex and interpolated, fragments only apply it
+		bool vertexLighting;
 	};
 }
@@ -0,0 +1,48 @@
+#include "pch.h"
+#include "shading_frame.h"
+#include "vertexbuffer.h"
+
+namespace platz {
+
+	void ShadingFrame::build(
+		const FramePacket& packet,
+		const FramePacket::View& view,
+		int width,
+		int height
+	) {
+		cameraPos = view.position;
+		projectionView = view.projectionView;
+
+		lightDirX.clear();
+		lightDirY.clear();
+		lightDirZ.clear();
+		lightIntensity.clear();
+		for (auto& light : packet.lights) {
+			if (light.type != Light::Type::Directional) {
+				continue;
+			}
+			lightDirX.push_back(light.direction.x);
+			lightDirY.push_back(light.direction.y);
+			lightDirZ.push_back(light.direction.z);
+			lightIntensity.push_back(light.intensity);
+		}
+
+		clusters.build(packet.lights, projectionView, width, height, view.znear, view.zfar);
+
+		shadowCasters.clear();
+		for (auto& draw : packet.draws) {
+			if (!draw.castShadows) {
+				continue;
+			}
+			auto vb = draw.vertexbuffer;
+			auto& worldMatrix = draw.worldMatrix;
+			for (size_t i = 0; i + 2 < vb->vertices.size(); i += 3) {
+				shadowCasters.emplace_back(
+					worldMatrix * vb->vertices[i].position.xyz,
+					worldMatrix * vb->vertices[i + 1].position.xyz,
+					worldMatrix * vb->vertices[i + 2].position.xyz
+				);
+			}
+		}
+	}
+}
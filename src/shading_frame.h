@@ -0,0 +1,44 @@
+#pragma once
+
+#include "light_clusters.h"
+#include "frame_packet.h"
+#include "triangle.h"
+#include "aligned_allocator.h"
+
+#include <vector>
+
+namespace platz {
+
+	//! Scene data resolved once per camera and frame from the frame packet.
+	//! Directional lights are stored one array per component, in the order of the light list.
+	class ShadingFrame {
+	public:
+
+		//! Each array starts on a cache line, so that 16 consecutive lights are one line read
+		using LightArray = std::vector<float, AlignedAllocator<float, 64>>;
+
+		zmath::Vector3 cameraPos;
+		zmath::Matrix44 projectionView;
+
+		//! Direction the light travels in, and intensity
+		LightArray lightDirX;
+		LightArray lightDirY;
+		LightArray lightDirZ;
+		LightArray lightIntensity;
+
+		//! Point and spot lights
+		LightClusters clusters;
+
+		//! Triangles of all shadow casting visuals, in world space
+		std::vector<zmath::Triangle> shadowCasters;
+
+		void build(
+			const FramePacket& packet,
+			const FramePacket::View& view,
+			int width,
+			int height
+		);
+
+		inline int directionalCount() const { return (int)lightIntensity.size(); }
+	};
+}
@@ -3,10 +3,301 @@
 #include "texture.h"
 
 #include "png_loader.h"
+#include "mapped_file.h"
+
+#include <climits>
+#include <new>
 
 namespace platz {
-	Texture::Texture(const std::string& path) {
-		_data = PNGLoader::load(path, width, height, bpp);
+
+	namespace texture {
+		inline int log2(int size) {
+			auto log = 0;
+			while ((1 << log) < size) {
+				++log;
+			}
+			return log;
+		}
+
+		//! RGBA8 texels of a strip of row-major rows, starting at row firstRow of the image
+		struct Rows {
+			const unsigned char* pixels;
+			int width;
+			int firstRow;
+
+			inline const unsigned char* operator()(int x, int y) const {
+				return pixels + ((size_t)(y - firstRow) * width + x) * 4;
+			}
+		};
+
+		//! RGBA8 texels of a tiled level
+		struct Tiles {
+			const unsigned char* pixels;
+			int tilesX;
+
+			inline const unsigned char* operator()(int x, int y) const {
+				return pixels + Texture::tiledIndex(x, y, tilesX) * 4;
+			}
+		};
+
+		// The encoders below write rows [y0, y1) of a level, y0 is a multiple of the tile size and
+		// y1 is one too unless it is the height of the level.
+		// Sources are Rows or Tiles, both keep the 4 texels of a tile row next to each other.
+
+		//! Copies RGBA8 texels into 4x4 tiles
+		template <typename Source>
+		void tile(const Source& src, const Texture::MipLevel& mip, int y0, int y1, unsigned char* dst) {
+			for (int y = y0; y < y1; ++y) {
+				for (int x = 0; x < mip.width; x += Texture::tileSize) {
+					const auto count = std::min(mip.width - x, (int)Texture::tileSize);
+					memcpy(dst + Texture::tiledIndex(x, y, mip.tilesX) * 4, src(x, y), (size_t)count * 4);
+				}
+			}
+		}
+
+		inline uint32_t to565(const unsigned char* rgb) {
+			const auto r = ((uint32_t)rgb[0] * 31 + 127) / 255;
+			const auto g = ((uint32_t)rgb[1] * 63 + 127) / 255;
+			const auto b = ((uint32_t)rgb[2] * 31 + 127) / 255;
+			return (r << 11) | (g << 5) | b;
+		}
+
+		template <typename Source>
+		void encode565(const Source& src, const Texture::MipLevel& mip, int y0, int y1, unsigned char* dst) {
+			auto texels = reinterpret_cast<uint16_t*>(dst);
+			for (int y = y0; y < y1; ++y) {
+				for (int x = 0; x < mip.width; ++x) {
+					texels[Texture::tiledIndex(x, y, mip.tilesX)] = (uint16_t)to565(src(x, y));
+				}
+			}
+		}
+
+		//! Bounding box endpoints, inset by 1/16 of the range, and nearest palette entry per texel.
+		//! Blocks with texels below half alpha use the 3 color mode, where index 3 is transparent.
+		void encodeBC1Block(const unsigned char texels[16][4], unsigned char* out) {
+			unsigned char min[3] = { 255, 255, 255 };
+			unsigned char max[3] = { 0, 0, 0 };
+			auto transparent = false;
+			for (int i = 0; i < 16; ++i) {
+				if (texels[i][3] < 128) {
+					transparent = true;
+					continue;
+				}
+				for (int k = 0; k < 3; ++k) {
+					min[k] = std::min(min[k], texels[i][k]);
+					max[k] = std::max(max[k], texels[i][k]);
+				}
+			}
+			if (min[0] > max[0]) {
+				// Fully transparent
+				min[0] = min[1] = min[2] = max[0] = max[1] = max[2] = 0;
+			}
+			for (int k = 0; k < 3; ++k) {
+				const auto inset = (max[k] - min[k]) >> 4;
+				min[k] = (unsigned char)(min[k] + inset);
+				max[k] = (unsigned char)(max[k] - inset);
+			}
+
+			auto c0 = to565(max);
+			auto c1 = to565(min);
+			if (transparent ? c0 > c1 : c0 < c1) {
+				std::swap(c0, c1);
+			}
+
+			uint32_t palette[4];
+			for (uint32_t i = 0; i < 4; ++i) {
+				palette[i] = bc1Color(c0, c1, i);
+			}
+			// Equal endpoints only need index 0
+			const auto colors = c0 == c1 ? 1 : transparent ? 3 : 4;
+
+			uint32_t indices = 0;
+			for (int i = 0; i < 16; ++i) {
+				uint32_t best = 3;
+				if (!transparent || texels[i][3] >= 128) {
+					auto bestDistance = INT_MAX;
+					for (int j = 0; j < colors; ++j) {
+						auto distance = 0;
+						for (int k = 0; k < 3; ++k) {
+							const auto d = (int)texels[i][k] - (int)((palette[j] >> (k * 8)) & 0xff);
+							distance += d * d;
+						}
+						if (distance < bestDistance) {
+							bestDistance = distance;
+							best = (uint32_t)j;
+						}
+					}
+				}
+				indices |= best << (i * 2);
+			}
+
+			out[0] = (unsigned char)c0;
+			out[1] = (unsigned char)(c0 >> 8);
+			out[2] = (unsigned char)c1;
+			out[3] = (unsigned char)(c1 >> 8);
+			for (int i = 0; i < 4; ++i) {
+				out[4 + i] = (unsigned char)(indices >> (i * 8));
+			}
+		}
+
+		template <typename Source>
+		void encodeBC1(const Source& src, const Texture::MipLevel& mip, int y0, int y1, unsigned char* dst) {
+			unsigned char texels[16][4];
+			for (int tileY = y0 / 4; tileY < (y1 + 3) / 4; ++tileY) {
+				for (int tileX = 0; tileX < mip.tilesX; ++tileX) {
+					// Partial blocks repeat the last row and column
+					for (int i = 0; i < 16; ++i) {
+						const auto x = std::min(tileX * 4 + (i & 3), mip.width - 1);
+						const auto y = std::min(tileY * 4 + (i >> 2), mip.height - 1);
+						memcpy(texels[i], src(x, y), 4);
+					}
+					encodeBC1Block(texels, dst + ((size_t)tileY * mip.tilesX + tileX) * 8);
+				}
+			}
+		}
+
+		template <typename Source>
+		void encode(Texture::Format format, const Source& src, const Texture::MipLevel& mip, int y0, int y1, unsigned char* dst) {
+			switch (format) {
+			case Texture::Format::RGB565:
+				encode565(src, mip, y0, y1, dst);
+				break;
+			case Texture::Format::BC1:
+				encodeBC1(src, mip, y0, y1, dst);
+				break;
+			default:
+				tile(src, mip, y0, y1, dst);
+				break;
+			}
+		}
+
+		//! 2x2 box filter into rows [y0, y1) of a tiled RGBA8 level, odd sizes reuse the last row or column.
+		//! Each row only reads source rows 2y and 2y + 1, so a strip can be filtered as soon as it is decoded.
+		template <typename Source>
+		void downsample(const Source& src, const Texture::MipLevel& srcMip, const Texture::MipLevel& mip, int y0, int y1, unsigned char* dst) {
+			for (int y = y0; y < y1; ++y) {
+				const auto sy0 = std::min(y * 2, srcMip.height - 1);
+				const auto sy1 = std::min(y * 2 + 1, srcMip.height - 1);
+				for (int x = 0; x < mip.width; ++x) {
+					const auto sx0 = std::min(x * 2, srcMip.width - 1);
+					const auto sx1 = std::min(x * 2 + 1, srcMip.width - 1);
+					const auto a = src(sx0, sy0);
+					const auto b = src(sx1, sy0);
+					const auto c = src(sx0, sy1);
+					const auto d = src(sx1, sy1);
+					auto out = dst + Texture::tiledIndex(x, y, mip.tilesX) * 4;
+					for (int k = 0; k < 4; ++k) {
+						out[k] = (unsigned char)((a[k] + b[k] + c[k] + d[k] + 2) / 4);
+					}
+				}
+			}
+		}
 	}
-}
 
+	Texture::Texture(const std::string& path, Format format)
+		: _path(path)
+		, _format(format) {
+		MappedFile file(path);
+		if (file.valid()) {
+			_data = decode(reinterpret_cast<const unsigned char*>(file.data()), file.size(), format, width, height);
+			_mips = mipChain(width, height, format);
+		}
+		setReady();
+	}
+
+	float Texture::lod(const UVDerivatives& derivatives) const {
+		return texture::lod(width, height, derivatives);
+	}
+
+	std::vector<Texture::MipLevel> Texture::mipChain(int width, int height, Format format) {
+		std::vector<MipLevel> mips;
+		if (width <= 0 || height <= 0) {
+			return mips;
+		}
+		size_t offset = 0;
+		while (true) {
+			MipLevel mip;
+			mip.width = width;
+			mip.height = height;
+			mip.offset = offset;
+			mip.tilesX = (width + tileSize - 1) / tileSize;
+			mip.tilesY = (height + tileSize - 1) / tileSize;
+			mip.bytes = (size_t)mip.tilesX * mip.tilesY * tileBytes(format);
+			mip.pow2 = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+			mip.tilesXLog2 = texture::log2(mip.tilesX);
+			mips.push_back(mip);
+			if (width == 1 && height == 1) {
+				break;
+			}
+			// Keep each level aligned
+			offset += (mip.bytes + alignment - 1) / alignment * alignment;
+			width = std::max(width / 2, 1);
+			height = std::max(height / 2, 1);
+		}
+		return mips;
+	}
+
+	std::shared_ptr<unsigned char[]> Texture::decode(const unsigned char* file, size_t size, Format format, int& width, int& height) {
+		// libpng hands over one tile row at a time, which is encoded into level 0 and filtered into level 1 right away.
+		// Every further level is filtered from the previous tiled one, so no full row-major copy of the image is made.
+		std::vector<MipLevel> mips;
+		std::shared_ptr<unsigned char[]> pixels;
+
+		// Encoded formats filter through RGBA8 copies of each level, RGBA8 levels are filtered in place
+		const auto encoded = format != Format::RGBA8;
+		std::unique_ptr<unsigned char[]> level;
+		std::unique_ptr<unsigned char[]> next;
+		auto rgba = [&](const MipLevel& mip) {
+			return new unsigned char[(size_t)mip.tilesX * mip.tilesY * tileBytes(Format::RGBA8)];
+		};
+
+		auto read = [&](const unsigned char* rows, int _width, int _height, int y, int count) {
+			if (!pixels) {
+				width = _width;
+				height = _height;
+				mips = mipChain(width, height, format);
+				const auto bytes = mips.back().offset + mips.back().bytes;
+				pixels.reset(new (std::align_val_t(alignment)) unsigned char[bytes], [](unsigned char* p) {
+					operator delete[](p, std::align_val_t(alignment));
+				});
+				if (encoded && mips.size() > 1) {
+					level.reset(rgba(mips[1]));
+				}
+			}
+
+			const texture::Rows src = { rows, width, y };
+			texture::encode(format, src, mips[0], y, y + count, pixels.get() + mips[0].offset);
+			if (mips.size() > 1) {
+				auto& dst = mips[1];
+				const auto end = y + count == height ? dst.height : (y + count) / 2;
+				texture::downsample(src, mips[0], dst, y / 2, end, encoded ? level.get() : pixels.get() + dst.offset);
+			}
+		};
+
+		if (!PNGLoader::load(file, size, tileSize, read) || !pixels) {
+			width = 0;
+			height = 0;
+			return nullptr;
+		}
+
+		for (size_t i = 1; i < mips.size(); ++i) {
+			auto& mip = mips[i];
+			const texture::Tiles src = { encoded ? level.get() : pixels.get() + mip.offset, mip.tilesX };
+			if (encoded) {
+				texture::encode(format, src, mip, 0, mip.height, pixels.get() + mip.offset);
+			}
+			if (i + 1 < mips.size()) {
+				auto& dst = mips[i + 1];
+				if (encoded && !next) {
+					next.reset(rgba(dst));
+				}
+				texture::downsample(src, mip, dst, 0, dst.height, encoded ? next.get() : pixels.get() + dst.offset);
+				if (encoded) {
+					// The previous level's buffer is large enough for all following levels
+					std::swap(level, next);
+				}
+			}
+		}
+		return pixels;
+	}
+}
@@ -1,20 +1,178 @@
 #pragma once
 
+#include "asset.h"
+#include "assets.h"
+#include "color.h"
+#include "texture_format.h"
+#include "vertex.h"
+
 namespace platz {
-	class Texture {
+
+	namespace texture {
+
+		//! RGB565 to RGBA8 packed in memory order, with zero alpha
+		inline uint32_t expand565(uint32_t color) {
+			const auto r = (color >> 11) & 31;
+			const auto g = (color >> 5) & 63;
+			const auto b = color & 31;
+			return ((r << 3) | (r >> 2)) | (((g << 2) | (g >> 4)) << 8) | (((b << 3) | (b >> 2)) << 16);
+		}
+
+		//! (a * wa + b * wb) / divisor for each RGB channel
+		inline uint32_t mix(uint32_t a, uint32_t b, uint32_t wa, uint32_t wb, uint32_t divisor) {
+			uint32_t result = 0;
+			for (int shift = 0; shift < 24; shift += 8) {
+				result |= ((((a >> shift) & 0xff) * wa + ((b >> shift) & 0xff) * wb) / divisor) << shift;
+			}
+			return result;
+		}
+
+		//! log2 of the texel footprint of a pixel, for a texture of the given size
+		inline float lod(int width, int height, const UVDerivatives& derivatives) {
+			const auto dx = zmath::Vector2(derivatives.dx.x * width, derivatives.dx.y * height);
+			const auto dy = zmath::Vector2(derivatives.dy.x * width, derivatives.dy.y * height);
+			const auto rho2 = std::max(dx.x * dx.x + dx.y * dx.y, dy.x * dy.x + dy.y * dy.y);
+			// log2(sqrt(rho2))
+			return rho2 > 1.f ? .5f * std::log2(rho2) : 0.f;
+		}
+
+		//! Color of a BC1 palette entry, RGBA8 packed in memory order
+		inline uint32_t bc1Color(uint32_t c0, uint32_t c1, uint32_t index) {
+			const auto a = expand565(c0);
+			const auto b = expand565(c1);
+			switch (index) {
+			case 0: return a | 0xff000000;
+			case 1: return b | 0xff000000;
+			case 2: return (c0 > c1 ? mix(a, b, 2, 1, 3) : mix(a, b, 1, 1, 2)) | 0xff000000;
+			default: return c0 > c1 ? mix(a, b, 1, 2, 3) | 0xff000000 : 0;
+			}
+		}
+	}
+
+	//! Pixels in one of the storage formats, followed by the full mip chain.
+	//! Each level is stored in 4x4 texel tiles so that texels close in 2D share cache lines.
+	class Texture : public Asset {
+		friend class Assets;
+
 	public:
 
+		using Format = TextureFormat;
+
+		//! Alignment of pixel storage, in bytes
+		static const size_t alignment = 64;
+
+		//! Tile side in texels, a 4x4 RGBA8 tile is one 64 byte cache line
+		static const int tileSize = 4;
+
+		struct MipLevel {
+			int width;
+			int height;
+			size_t offset;
+			size_t bytes;
+
+			//! Tiles per row and column, partial tiles are padded
+			int tilesX;
+			int tilesY;
+
+			//! Both sizes are powers of two, texel addresses can be wrapped with masks and shifts
+			bool pow2;
+			int tilesXLog2;
+		};
+
 		int width = 0;
 		int height = 0;
-		int bpp = 0;
+		int bpp = 4;
+
+		Texture(const std::string& _path, Format format = Format::RGBA8);
+
+		inline Format format() const { return _format; }
+
+		inline unsigned char* data() const { return _data.get(); }
+		inline unsigned char* data(int level) const { return _data.get() + _mips[level].offset; }
 
-		Texture(const std::string& _path);
+		//! Size in bytes of all mip levels
+		inline size_t size() const { return _mips.empty() ? 0 : _mips.back().offset + _mips.back().bytes; }
 
-		inline unsigned char* data() const { return _data; }
+		inline int mipCount() const { return (int)_mips.size(); }
+		inline const MipLevel& mip(int level) const { return _mips[level]; }
+
+		//! Mip level to use for the given derivatives, fractional for trilinear filtering
+		float lod(const UVDerivatives& derivatives) const;
+
+		//! Index of a texel within its level: tiles are row-major, and so are texels within a tile
+		static inline size_t tiledIndex(int x, int y, int tilesX) {
+			return ((size_t)(y >> 2) * tilesX + (x >> 2)) * (tileSize * tileSize) + ((y & 3) << 2) + (x & 3);
+		}
+
+		//! Bytes used by a 4x4 tile
+		static inline size_t tileBytes(Format format) {
+			switch (format) {
+			case Format::RGB565: return 32;
+			case Format::BC1: return 8;
+			default: return 64;
+			}
+		}
+
+		//! Texels of an RGBA8 texture
+		inline const uint32_t* texels(int level) const { return reinterpret_cast<const uint32_t*>(data(level)); }
+
+		//! RGBA8 texel packed in memory order, decoded from the storage format
+		template <Format format>
+		inline uint32_t fetch(int level, int x, int y) const;
+
+		//! Prefer fetch() in loops, this checks the format for every texel
+		inline uint32_t texel(int level, int x, int y) const;
+
+		//! Marks the texture as used this frame. Evicted textures are reloaded by Assets::update().
+		inline void touch() { _lastUsedFrame = Assets::frame(); }
 
 	private:
 
-		unsigned char* _data = nullptr;
+		Texture() = default;
+
+		//! Decodes an image file into new tiled storage and generates its mip chain
+		static std::shared_ptr<unsigned char[]> decode(const unsigned char* file, size_t size, Format format, int& width, int& height);
+
+		static std::vector<MipLevel> mipChain(int width, int height, Format format);
+
+		std::string _path;
+		Format _format = Format::RGBA8;
+		std::shared_ptr<unsigned char[]> _data;
+		std::vector<MipLevel> _mips;
+		uint64_t _hash = 0;
+		uint64_t _lastUsedFrame = 0;
+
+		//! Set while a background load is in flight, only accessed with the Assets registry lock held
+		bool _loadPending = false;
 	};
-}
 
+	template <>
+	inline uint32_t Texture::fetch<Texture::Format::RGBA8>(int level, int x, int y) const {
+		return texels(level)[tiledIndex(x, y, _mips[level].tilesX)];
+	}
+
+	template <>
+	inline uint32_t Texture::fetch<Texture::Format::RGB565>(int level, int x, int y) const {
+		const auto color = reinterpret_cast<const uint16_t*>(data(level))[tiledIndex(x, y, _mips[level].tilesX)];
+		return texture::expand565(color) | 0xff000000;
+	}
+
+	template <>
+	inline uint32_t Texture::fetch<Texture::Format::BC1>(int level, int x, int y) const {
+		// Block: color0, color1, then 2 bits per texel, all little-endian
+		const auto block = data(level) + ((size_t)(y >> 2) * _mips[level].tilesX + (x >> 2)) * 8;
+		const auto c0 = (uint32_t)block[0] | (uint32_t)block[1] << 8;
+		const auto c1 = (uint32_t)block[2] | (uint32_t)block[3] << 8;
+		const auto shift = (((y & 3) << 2) + (x & 3)) * 2;
+		const auto index = ((uint32_t)block[4 + (shift >> 3)] >> (shift & 7)) & 3;
+		return texture::bc1Color(c0, c1, index);
+	}
+
+	inline uint32_t Texture::texel(int level, int x, int y) const {
+		switch (_format) {
+		case Format::RGB565: return fetch<Format::RGB565>(level, x, y);
+		case Format::BC1: return fetch<Format::BC1>(level, x, y);
+		default: return fetch<Format::RGBA8>(level, x, y);
+		}
+	}
+}
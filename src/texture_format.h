@@ -0,0 +1,14 @@
+#pragma once
+
+namespace platz {
+
+	//! Storage format of a texture, chosen per texture at load
+	enum class TextureFormat {
+		//! 32 bits per texel
+		RGBA8,
+		//! 16 bits per texel, opaque
+		RGB565,
+		//! 4 bits per texel: each 4x4 tile holds two RGB565 endpoints and 2 bit palette indices, alpha is 1 bit
+		BC1
+	};
+}
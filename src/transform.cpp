@@ -1,41 +1,100 @@
-
 #include "pch.h"
 #include "transform.h"
+#include "transforms.h"
+#include "components.h"
+#include "entities.h"
 
 namespace platz {
 	DEFINE_OBJECT(Transform);
 
-	const Matrix44& Transform::worldMatrix() {
-		if (_worldMatrixDirty) {
-			_worldMatrix = zmath::Matrix44::compose(_position, _rotation, _scale);
-			_worldMatrixDirty = false;
+	Transform::Transform() {
+		Transforms::track();
+	}
+
+	Transform::Transform(
+		const Vector3& position,
+		const Quaternion& rotation,
+		const Vector3& scale
+	) :
+		_position(position),
+		_rotation(rotation),
+		_scale(scale) {
+		Transforms::track();
+	}
+
+	void Transform::position(const Vector3& v) {
+		_position = v;
+		changed();
+	}
+
+	void Transform::rotation(const Quaternion& q) {
+		_rotation = q;
+		changed();
+	}
+
+	void Transform::scale(const Vector3& v) {
+		_scale = v;
+		changed();
+	}
+
+	Transform* Transform::parent() const {
+		auto parent = Entities::get(_parent);
+		return parent ? parent->getComponent<Transform>() : nullptr;
+	}
+
+	void Transform::parent(Transform* parent) {
+		for (auto ancestor = parent; ancestor; ancestor = ancestor->parent()) {
+			if (ancestor == this) {
+				return;
+			}
 		}
-		return _worldMatrix;
+		_parent = parent ? parent->entity()->handle() : EntityHandle();
+		Transforms::_orderDirty = true;
+		changed();
 	}
 
-	Vector3 Transform::worldForward() {
-		Vector3 dummy;
-		Quaternion worldRotation;
-		worldMatrix().decompose(dummy, worldRotation, dummy);
-		return (worldRotation * Vector3::forward).normalized();
+	Vector3 Transform::worldForward() const {
+		return (worldRotation() * Vector3::forward).normalized();
 	}
 
-	Vector3 Transform::worldRight() {
-		Vector3 dummy;
-		Quaternion worldRotation;
-		worldMatrix().decompose(dummy, worldRotation, dummy);
-		return (worldRotation * Vector3::right).normalized();
+	Vector3 Transform::worldRight() const {
+		return (worldRotation() * Vector3::right).normalized();
 	}
 
-	Vector3 Transform::worldUp() {
-		Vector3 dummy;
-		Quaternion worldRotation;
-		worldMatrix().decompose(dummy, worldRotation, dummy);
-		return (worldRotation * Vector3::up).normalized();
+	Vector3 Transform::worldUp() const {
+		return (worldRotation() * Vector3::up).normalized();
 	}
 
-	void Transform::preUpdate() {
-		_worldMatrixDirty = true;
+	const Matrix44& Transform::worldMatrix() const {
+		if (Transforms::pending()) {
+			Transforms::update();
+		}
+		return _worldMatrix;
+	}
+
+	const Quaternion& Transform::worldRotation() const {
+		if (Transforms::pending()) {
+			Transforms::update();
+		}
+		return _worldRotation;
+	}
+
+	void Transform::changed() {
+		Transforms::queue(this);
+		Components::changed(this);
 	}
-}
 
+	void Transform::updateWorld() {
+		const auto local = zmath::Matrix44::compose(_position, _rotation, _scale);
+		auto parentTransform = parent();
+		if (!parentTransform) {
+			_worldMatrix = local;
+			_worldRotation = _rotation;
+			return;
+		}
+		_worldMatrix = parentTransform->_worldMatrix * local;
+		Vector3 position;
+		Vector3 scale;
+		_worldMatrix.decompose(position, _worldRotation, scale);
+	}
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "component.h"
+#include "entity.h"
 
 #include "vector3.h"
 #include "quaternion.h"
@@ -10,9 +11,12 @@ namespace platz {
 
 	using namespace zmath;
 
+	//! Position, rotation and scale relative to an optional parent.
+	//! World matrices are cached and recomputed by Transforms::update() after a change.
 	class Transform : public Component {
 
 		DECLARE_OBJECT(Transform, Component);
+		friend class Transforms;
 
 	private:
 
@@ -20,42 +24,61 @@ namespace platz {
 		Quaternion _rotation;
 		Vector3 _scale;
 
+		//! Entity owning the parent transform, the handle goes stale if the parent entity is destroyed
+		EntityHandle _parent;
+
 		Matrix44 _worldMatrix;
-		bool _worldMatrixDirty = true;
+		Quaternion _worldRotation;
+
+		//! Position in the sorted update order, and end of the subtree rooted here
+		int _orderIndex = 0;
+		int _subtreeEnd = 0;
+
+		//! Waiting in the update queue
+		bool _queued = false;
 
 	public:
 
-		Transform() = default;
+		Transform();
 
 		Transform(
 			const Vector3& position,
 			const Quaternion& rotation,
 			const Vector3& scale
-		) :
-			_position(position),
-			_rotation(rotation),
-			_scale(scale) {
-		}
+		);
 
 		inline const Vector3& position() const { return _position; }
-		inline void position(const Vector3& v) { _position = v; }
+		void position(const Vector3& v);
 		inline const Quaternion& rotation() const { return _rotation; }
-		inline void rotation(const Quaternion& q) { _rotation = q; }
+		void rotation(const Quaternion& q);
 		inline const Vector3& scale() const { return _scale; }
-		inline void scale(const Vector3& v) { _scale = v; }
+		void scale(const Vector3& v);
+
+		//! nullptr for root transforms, or if the parent entity was destroyed or lost its transform
+		Transform* parent() const;
+
+		//! Pass nullptr to detach. Parenting to a descendant is ignored.
+		void parent(Transform* parent);
 
 		inline Vector3 forward() const { return _rotation * Vector3::forward; }
 		inline Vector3 right() const { return _rotation * Vector3::right; }
 		inline Vector3 up() const { return _rotation * Vector3::up; }
 
-		inline Vector3 worldPosition() { return Vector3(worldMatrix()); }
+		inline Vector3 worldPosition() const { return Vector3(worldMatrix()); }
+
+		Vector3 worldForward() const;
+		Vector3 worldRight() const;
+		Vector3 worldUp() const;
 
-		Vector3 worldForward();
-		Vector3 worldRight();
-		Vector3 worldUp();
+		const Matrix44& worldMatrix() const;
+		const Quaternion& worldRotation() const;
+
+	private:
 
-		const Matrix44& worldMatrix();
+		//! Queues the transform and its children for update
+		void changed();
 
-		virtual void preUpdate() override;
+		//! Recomputes the world matrix from the parent's, which must be up to date
+		void updateWorld();
 	};
 }
@@ -0,0 +1,154 @@
+
+#include "pch.h"
+#include "transforms.h"
+#include "components.h"
+
+#include <algorithm>
+
+namespace platz {
+
+	std::vector<Transform*> Transforms::_order;
+	int Transforms::_holes = 0;
+	std::vector<Transform*> Transforms::_queue;
+	bool Transforms::_orderDirty = false;
+	bool Transforms::_tracking = false;
+
+	void Transforms::track() {
+		if (_tracking) {
+			return;
+		}
+		_tracking = true;
+		Components::onAdded<Transform>(&Transforms::add);
+		Components::onRemoved<Transform>(&Transforms::remove);
+	}
+
+	void Transforms::add(Transform* transform) {
+		// A root until parented, which sorts again
+		transform->_orderIndex = (int)_order.size();
+		transform->_subtreeEnd = transform->_orderIndex + 1;
+		_order.push_back(transform);
+		queue(transform);
+	}
+
+	void Transforms::remove(Transform* transform) {
+		if (transform->_queued) {
+			_queue.erase(std::find(_queue.begin(), _queue.end(), transform));
+		}
+
+		// Children become roots, found through their parent link before it is cleared
+		const auto index = transform->_orderIndex;
+		const auto placed = !_orderDirty && index < (int)_order.size() && _order[index] == transform;
+		if (placed) {
+			for (auto i = index + 1; i < transform->_subtreeEnd; ++i) {
+				if (_order[i] && _order[i]->parent() == transform) {
+					_order[i]->_parent = EntityHandle();
+					queue(_order[i]);
+				}
+			}
+			_order[index] = nullptr;
+			++_holes;
+		} else {
+			for (auto other : Components::ofType<Transform>()) {
+				if (other->parent() == transform) {
+					other->_parent = EntityHandle();
+					queue(other);
+				}
+			}
+			// The next sort rebuilds the order without it
+			_orderDirty = true;
+		}
+		if (_holes * 2 > (int)_order.size()) {
+			_orderDirty = true;
+		}
+	}
+
+	void Transforms::queue(Transform* transform) {
+		if (!transform->_queued) {
+			transform->_queued = true;
+			_queue.push_back(transform);
+		}
+	}
+
+	void Transforms::sort() {
+		auto& transforms = Components::ofType<Transform>();
+		const auto count = (int)transforms.size();
+
+		// Children lists, rebuilt from the parent links in storage order
+		std::vector<int> firstChild(count, -1);
+		std::vector<int> nextSibling(count, -1);
+		for (int i = 0; i < count; ++i) {
+			transforms[i]->_orderIndex = i;
+		}
+		std::vector<int> roots;
+		for (int i = count - 1; i >= 0; --i) {
+			if (auto parent = transforms[i]->parent()) {
+				nextSibling[i] = firstChild[parent->_orderIndex];
+				firstChild[parent->_orderIndex] = i;
+			} else {
+				roots.push_back(i);
+			}
+		}
+
+		_order.clear();
+		_holes = 0;
+		std::vector<int> stack;
+		for (auto root = roots.rbegin(); root != roots.rend(); ++root) {
+			stack.push_back(*root);
+			while (!stack.empty()) {
+				const auto node = stack.back();
+				stack.pop_back();
+				_order.push_back(transforms[node]);
+				// Pushed in reverse, so that the first child is visited first
+				const auto childrenStart = stack.size();
+				for (auto child = firstChild[node]; child >= 0; child = nextSibling[child]) {
+					stack.push_back(child);
+				}
+				std::reverse(stack.begin() + childrenStart, stack.end());
+			}
+		}
+
+		for (int i = 0; i < count; ++i) {
+			_order[i]->_orderIndex = i;
+		}
+
+		// Children come after their parent, so subtree sizes are complete when walking backwards
+		std::vector<int> sizes(count, 1);
+		for (int i = count - 1; i >= 0; --i) {
+			auto transform = _order[i];
+			transform->_subtreeEnd = i + sizes[i];
+			if (auto parent = transform->parent()) {
+				sizes[parent->_orderIndex] += sizes[i];
+			}
+		}
+	}
+
+	void Transforms::update() {
+		// Only the order changes, world matrices are recomputed for the queued subtrees as usual
+		if (_orderDirty) {
+			_orderDirty = false;
+			sort();
+		}
+
+		if (_queue.empty()) {
+			return;
+		}
+		std::sort(_queue.begin(), _queue.end(), [](const Transform* a, const Transform* b) {
+			return a->_orderIndex < b->_orderIndex;
+		});
+		auto updatedEnd = 0;
+		for (auto transform : _queue) {
+			transform->_queued = false;
+			// Skip transforms inside a subtree that was already updated
+			if (transform->_orderIndex < updatedEnd) {
+				continue;
+			}
+			for (auto i = transform->_orderIndex; i < transform->_subtreeEnd; ++i) {
+				if (_order[i]) {
+					_order[i]->updateWorld();
+				}
+			}
+			updatedEnd = transform->_subtreeEnd;
+		}
+		_queue.clear();
+	}
+}
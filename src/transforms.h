@@ -0,0 +1,49 @@
+#pragma once
+
+#include "transform.h"
+
+#include <vector>
+
+namespace platz {
+
+	//! Updates world matrices in a single pass over all transforms, parents before children.
+	//! Transforms are sorted depth first so that each subtree is a contiguous range,
+	//! and only the subtrees of changed transforms are recomputed.
+	//! New transforms are appended as roots and removed ones leave a hole, so only reparenting needs a new sort.
+	class Transforms {
+
+		friend class Transform;
+
+		//! Depth-first order of all transforms, nullptr where a transform was removed
+		static std::vector<Transform*> _order;
+		static int _holes;
+
+		//! Transforms changed since the last update
+		static std::vector<Transform*> _queue;
+
+		//! Set when transforms are reparented, or when holes make up half of the order
+		static bool _orderDirty;
+
+		//! Set once the pool callbacks below are registered
+		static bool _tracking;
+
+		//! Registers add() and remove() with the Transform pool, called by each Transform constructor.
+		//! The first transform is constructed before its pool notifies the callbacks, so it is tracked too.
+		static void track();
+
+		static void add(Transform* transform);
+		static void remove(Transform* transform);
+
+		static void queue(Transform* transform);
+
+		static void sort();
+
+	public:
+
+		inline static bool pending() { return _orderDirty || !_queue.empty(); }
+
+		//! Called once per frame by Engine, and by world matrix reads while changes are pending.
+		//! Not thread safe, rendering threads only read transforms after the update.
+		static void update();
+	};
+}
@@ -12,6 +12,12 @@ namespace platz {
 		zmath::Vector3 normal;
 		Color color;
 
+		//! Diffuse, specular and ambient light terms, for materials lighting vertices.
+		//! Set per draw from the world-space position and normal.
+		zmath::Vector3 lighting = zmath::Vector3(0.f, 0.f, 0.f);
+
+		Vertex() = default;
+
 		Vertex(
 			const zmath::Vector4& _position,
 			const zmath::Vector2& _uv,
@@ -26,5 +32,11 @@ namespace platz {
 
 		}
 	};
+
+	//! Screen-space rate of change of texture coordinates, per pixel
+	struct UVDerivatives {
+		zmath::Vector2 dx;
+		zmath::Vector2 dy;
+	};
 }
 
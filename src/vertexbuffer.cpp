@@ -1,7 +1,20 @@
-
 #include "pch.h"
 #include "vertexbuffer.h"
 
 namespace platz {
 
+	void Vertexbuffer::computeBounds() {
+		if (vertices.empty()) {
+			boundsMin = zmath::Vector3::zero;
+			boundsMax = zmath::Vector3::zero;
+			return;
+		}
+		boundsMin = vertices[0].position.xyz;
+		boundsMax = vertices[0].position.xyz;
+		for (auto& vertex : vertices) {
+			auto& position = vertex.position;
+			boundsMin = zmath::Vector3(std::min(boundsMin.x, position.x), std::min(boundsMin.y, position.y), std::min(boundsMin.z, position.z));
+			boundsMax = zmath::Vector3(std::max(boundsMax.x, position.x), std::max(boundsMax.y, position.y), std::max(boundsMax.z, position.z));
+		}
+	}
 }
@@ -9,10 +9,24 @@ namespace platz {
 
 		std::vector<Vertex> vertices;
 
+		//! Local space bounding box of the vertices, computed at construction
+		zmath::Vector3 boundsMin;
+		zmath::Vector3 boundsMax;
+
 		Vertexbuffer(const std::vector<Vertex>& _vertices)
 			: vertices(_vertices)
 		{
+			computeBounds();
+		}
+
+		Vertexbuffer(std::vector<Vertex>&& _vertices)
+			: vertices(std::move(_vertices))
+		{
+			computeBounds();
 		}
+
+	private:
+
+		void computeBounds();
 	};
 }
-
@@ -0,0 +1,246 @@
+
+#include "pch.h"
+#include "virtual_texture.h"
+#include "mapped_file.h"
+
+#include <fstream>
+#include <new>
+
+namespace platz {
+
+	namespace virtualtexture {
+
+		const char magic[4] = { 'P', 'V', 'T', '1' };
+
+		struct Header {
+			char magic[4];
+			uint32_t width;
+			uint32_t height;
+			uint32_t pageSize;
+			uint32_t levels;
+		};
+
+		//! Pages start after the header, level by level, row-major within a level
+		const size_t headerBytes = 64;
+
+		std::vector<VirtualTexture::Level> levels(int width, int height) {
+			std::vector<VirtualTexture::Level> levels;
+			if (width <= 0 || height <= 0) {
+				return levels;
+			}
+			auto firstPage = 0;
+			while (true) {
+				VirtualTexture::Level level;
+				level.width = width;
+				level.height = height;
+				level.pow2 = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+				level.pagesX = (width + VirtualTexture::pageSize - 1) / VirtualTexture::pageSize;
+				level.pagesY = (height + VirtualTexture::pageSize - 1) / VirtualTexture::pageSize;
+				level.firstPage = firstPage;
+				levels.push_back(level);
+				if (width == 1 && height == 1) {
+					break;
+				}
+				firstPage += level.pagesX * level.pagesY;
+				width = std::max(width / 2, 1);
+				height = std::max(height / 2, 1);
+			}
+			return levels;
+		}
+	}
+
+	VirtualTexture::VirtualTexture(int cachePages)
+		: _cachePages(cachePages) {
+	}
+
+	VirtualTexture::~VirtualTexture() = default;
+
+	bool VirtualTexture::bake(const std::string& imagePath, const std::string& pagePath) {
+		Texture image(imagePath);
+		if (!image.data()) {
+			return false;
+		}
+
+		std::ofstream out(pagePath, std::ios::binary);
+		if (!out) {
+			return false;
+		}
+
+		const auto levels = virtualtexture::levels(image.width, image.height);
+		virtualtexture::Header header;
+		memcpy(header.magic, virtualtexture::magic, sizeof(header.magic));
+		header.width = (uint32_t)image.width;
+		header.height = (uint32_t)image.height;
+		header.pageSize = pageSize;
+		header.levels = (uint32_t)levels.size();
+		char headerData[virtualtexture::headerBytes] = {};
+		memcpy(headerData, &header, sizeof(header));
+		out.write(headerData, sizeof(headerData));
+
+		std::vector<uint32_t> page((size_t)pageSize * pageSize);
+		for (int i = 0; i < (int)levels.size(); ++i) {
+			auto& level = levels[i];
+			for (int pageY = 0; pageY < level.pagesY; ++pageY) {
+				for (int pageX = 0; pageX < level.pagesX; ++pageX) {
+					// Partial pages repeat the last row and column
+					for (int y = 0; y < pageSize; ++y) {
+						const auto sourceY = std::min(pageY * pageSize + y, level.height - 1);
+						for (int x = 0; x < pageSize; ++x) {
+							const auto sourceX = std::min(pageX * pageSize + x, level.width - 1);
+							page[Texture::tiledIndex(x, y, pageSize / Texture::tileSize)] = image.fetch<Texture::Format::RGBA8>(i, sourceX, sourceY);
+						}
+					}
+					out.write(reinterpret_cast<const char*>(page.data()), pageBytes);
+				}
+			}
+		}
+		return (bool)out;
+	}
+
+	float VirtualTexture::lod(const UVDerivatives& derivatives) const {
+		return texture::lod(width, height, derivatives);
+	}
+
+	void VirtualTexture::open(const std::string& path) {
+		_file = std::make_unique<MappedFile>(path);
+		if (!_file->valid() || _file->size() < virtualtexture::headerBytes) {
+			setReady();
+			return;
+		}
+
+		virtualtexture::Header header;
+		memcpy(&header, _file->data(), sizeof(header));
+		auto levels = virtualtexture::levels((int)header.width, (int)header.height);
+		if (levels.empty()
+			|| memcmp(header.magic, virtualtexture::magic, sizeof(header.magic)) != 0
+			|| header.pageSize != pageSize
+			|| header.levels != levels.size()) {
+			setReady();
+			return;
+		}
+
+		const auto pageCount = levels.back().firstPage + 1;
+		if (_file->size() < virtualtexture::headerBytes + (size_t)pageCount * pageBytes) {
+			setReady();
+			return;
+		}
+
+		// Levels from the first one fitting in a single page are never evicted
+		auto pinnedLevel = 0;
+		while (levels[pinnedLevel].pagesX > 1 || levels[pinnedLevel].pagesY > 1) {
+			++pinnedLevel;
+		}
+		_pinnedSlots = (int)levels.size() - pinnedLevel;
+		_cachePages = std::max(_cachePages, _pinnedSlots + 1);
+
+		const auto texels = (size_t)_cachePages * pageSize * pageSize;
+		_cache.reset(new (std::align_val_t(Texture::alignment)) uint32_t[texels], [](uint32_t* p) {
+			operator delete[](p, std::align_val_t(Texture::alignment));
+		});
+		_slots.resize(_cachePages);
+		_pageTable.assign(pageCount, Missing);
+		_requested.reset(new std::atomic<uint32_t>[pageCount]());
+
+		for (int slot = 0; slot < _pinnedSlots; ++slot) {
+			const auto page = levels[pinnedLevel + slot].firstPage;
+			memcpy(_cache.get() + (size_t)slot * pageSize * pageSize, _file->data() + virtualtexture::headerBytes + (size_t)page * pageBytes, pageBytes);
+			_slots[slot].page = page;
+			_pageTable[page] = slot;
+		}
+
+		_levels = std::move(levels);
+		width = (int)header.width;
+		height = (int)header.height;
+		setReady();
+	}
+
+	void VirtualTexture::load(int page, int slot) {
+		memcpy(_cache.get() + (size_t)slot * pageSize * pageSize, _file->data() + virtualtexture::headerBytes + (size_t)page * pageBytes, pageBytes);
+
+		std::lock_guard<std::mutex> lock(_streamedMutex);
+		_streamed.push_back({ page, slot });
+	}
+
+	void VirtualTexture::publish() {
+		std::lock_guard<std::mutex> lock(_streamedMutex);
+		for (auto& streamed : _streamed) {
+			_pageTable[streamed.page] = streamed.slot;
+			--_streaming;
+		}
+		_streamed.clear();
+	}
+
+	std::vector<int> VirtualTexture::requests() {
+		const auto frame = (uint32_t)Assets::frame();
+
+		// Request the parents of requested pages, they are used while the children are missing
+		for (int i = 0; i + 1 < (int)_levels.size(); ++i) {
+			auto& level = _levels[i];
+			auto& parent = _levels[i + 1];
+			for (int pageY = 0; pageY < level.pagesY; ++pageY) {
+				for (int pageX = 0; pageX < level.pagesX; ++pageX) {
+					if (_requested[level.firstPage + pageY * level.pagesX + pageX].load(std::memory_order_relaxed) != frame) {
+						continue;
+					}
+					const auto parentX = std::min(pageX >> 1, parent.pagesX - 1);
+					const auto parentY = std::min(pageY >> 1, parent.pagesY - 1);
+					_requested[parent.firstPage + parentY * parent.pagesX + parentX].store(frame, std::memory_order_relaxed);
+				}
+			}
+		}
+
+		std::vector<int> pages;
+		for (int i = (int)_levels.size() - 1; i >= 0; --i) {
+			auto& level = _levels[i];
+			const auto end = level.firstPage + level.pagesX * level.pagesY;
+			for (int page = level.firstPage; page < end; ++page) {
+				if (_requested[page].load(std::memory_order_relaxed) != frame) {
+					continue;
+				}
+				const auto slot = _pageTable[page];
+				if (slot >= 0) {
+					_slots[slot].lastUsedFrame = Assets::frame();
+				} else if (slot == Missing) {
+					pages.push_back(page);
+				}
+			}
+		}
+		return pages;
+	}
+
+	int VirtualTexture::allocate(int page) {
+		if (_streaming >= maxStreams) {
+			return -1;
+		}
+
+		const auto frame = Assets::frame();
+		auto best = -1;
+		for (int i = _pinnedSlots; i < _cachePages; ++i) {
+			auto& slot = _slots[i];
+			if (slot.page == Missing) {
+				best = i;
+				break;
+			}
+			if (_pageTable[slot.page] == Streaming || slot.lastUsedFrame >= frame) {
+				// Still loading, or sampled this frame
+				continue;
+			}
+			if (best < 0 || slot.lastUsedFrame < _slots[best].lastUsedFrame) {
+				best = i;
+			}
+		}
+		if (best < 0) {
+			return -1;
+		}
+
+		auto& slot = _slots[best];
+		if (slot.page != Missing) {
+			_pageTable[slot.page] = Missing;
+		}
+		slot.page = page;
+		slot.lastUsedFrame = frame;
+		_pageTable[page] = Streaming;
+		++_streaming;
+		return best;
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "asset.h"
+#include "texture.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace platz {
+
+	class MappedFile;
+
+	//! RGBA8 texture split in fixed-size pages, streamed from a page file on demand.
+	//! Pages sampled during a frame are loaded by Assets::update() into a fixed-size cache,
+	//! so memory does not depend on the size of the source image.
+	//! Missing texels are read from coarser levels, the levels fitting in a single page always stay resident.
+	class VirtualTexture : public Asset {
+		friend class Assets;
+
+	public:
+
+		//! Page side in texels, pages are stored in 4x4 tiles like Texture levels
+		static const int pageSize = 128;
+		static const int pageShift = 7;
+		static const size_t pageBytes = (size_t)pageSize * pageSize * 4;
+
+		//! Pages being streamed at most, per texture
+		static const int maxStreams = 32;
+
+		struct Level {
+			int width;
+			int height;
+			bool pow2;
+			int pagesX;
+			int pagesY;
+
+			//! Index of the first page of this level in the page file and the page table
+			int firstPage;
+		};
+
+		int width = 0;
+		int height = 0;
+
+		~VirtualTexture();
+
+		//! Splits an image and its mip chain in the page file format read by Assets::loadVirtualTexture()
+		static bool bake(const std::string& imagePath, const std::string& pagePath);
+
+		//! Physical page cache, null if the page file could not be opened
+		inline const uint32_t* data() const { return _cache.get(); }
+
+		inline int levelCount() const { return (int)_levels.size(); }
+		inline const Level& level(int index) const { return _levels[index]; }
+		inline int cachePages() const { return _cachePages; }
+
+		//! Mip level to use for the given derivatives, fractional for trilinear filtering
+		float lod(const UVDerivatives& derivatives) const;
+
+		//! Marks the page holding a texel as needed this frame
+		inline void request(int level, int x, int y) const {
+			_requested[page(level, x, y)].store((uint32_t)Assets::frame(), std::memory_order_relaxed);
+		}
+
+		//! RGBA8 texel packed in memory order, from the finest resident level
+		inline uint32_t fetch(int level, int x, int y) const {
+			while (true) {
+				const auto slot = _pageTable[page(level, x, y)];
+				if (slot >= 0) {
+					const auto mask = pageSize - 1;
+					return _cache[(size_t)slot * pageSize * pageSize + Texture::tiledIndex(x & mask, y & mask, pageSize / Texture::tileSize)];
+				}
+				// Odd sizes round down, the last texel has no exact parent
+				++level;
+				x = std::min(x >> 1, _levels[level].width - 1);
+				y = std::min(y >> 1, _levels[level].height - 1);
+			}
+		}
+
+	private:
+
+		//! Page table entries that are not a cache slot
+		enum PageState {
+			Missing = -1,
+			Streaming = -2
+		};
+
+		struct Slot {
+			int page = Missing;
+			uint64_t lastUsedFrame = 0;
+		};
+
+		struct Streamed {
+			int page;
+			int slot;
+		};
+
+		VirtualTexture(int cachePages);
+
+		inline int page(int level, int x, int y) const {
+			auto& l = _levels[level];
+			return l.firstPage + (y >> pageShift) * l.pagesX + (x >> pageShift);
+		}
+
+		//! Maps the page file and loads the pinned levels, runs on a worker thread
+		void open(const std::string& path);
+
+		//! Copies a page from the file into its cache slot, runs on a worker thread
+		void load(int page, int slot);
+
+		//! Maps pages streamed since the last call
+		void publish();
+
+		//! Pages requested this frame that are not resident, coarsest first, including their missing parents
+		std::vector<int> requests();
+
+		//! Reserves a free or least recently used slot for a page.
+		//! Returns -1 if all slots are in use or too many pages are already streaming.
+		int allocate(int page);
+
+		int _cachePages;
+		std::unique_ptr<MappedFile> _file;
+		std::vector<Level> _levels;
+		std::shared_ptr<uint32_t[]> _cache;
+		std::vector<Slot> _slots;
+
+		//! Slot of each page, or a PageState. Only modified from Assets::update().
+		std::vector<int> _pageTable;
+
+		//! Last frame each page was sampled, written while rendering
+		std::unique_ptr<std::atomic<uint32_t>[]> _requested;
+
+		//! Slots before this one hold the pinned levels
+		int _pinnedSlots = 0;
+		int _streaming = 0;
+
+		std::mutex _streamedMutex;
+		std::vector<Streamed> _streamed;
+	};
+}
@@ -16,10 +16,25 @@ namespace platz {
 		bool receiveShadows = true;
 		bool castShadows = true;
 
+		//! Visuals smaller than this on screen, in pixels along their largest side,
+		//! are lit per vertex if their material supports it. 0 disables the switch.
+		float vertexLightingSize = 0.f;
+
+		//! Drawn while geometry is still loading
+		std::shared_ptr<Geometry> placeholder;
+
 		Visual(const std::shared_ptr<Geometry>& _geometry, const std::shared_ptr<Material>& _material)
 			: geometry(_geometry)
 			, material(_material) {
 
 		}
+
+		//! Returns nullptr if there is nothing to draw yet
+		Vertexbuffer* getVertexBuffer() const {
+			if (auto vb = geometry->getVertexBuffer()) {
+				return vb;
+			}
+			return placeholder ? placeholder->getVertexBuffer() : nullptr;
+		}
 	};
 }
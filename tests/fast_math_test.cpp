@@ -0,0 +1,234 @@
+
+// Checks the fast math approximations against the standard library, in double precision, over the ranges used
+// while shading. Each function must stay within the error bound documented in fast_math.h.
+// Returns a non-zero exit code if any bound is exceeded.
+// The scalar functions are checked directly, the batched ones in whichever form fast_math.h compiled, SSE2 on x64.
+// Building without SSE2 (e.g. /arch:IA32 or -mno-sse2) checks their scalar fallbacks.
+
+#include "fast_math.h"
+
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+
+using namespace platz;
+
+namespace {
+
+	int failures = 0;
+
+	//! Largest error seen by a check, reported with its bound once the sweep is done
+	struct Check {
+		std::string name;
+		double bound;
+		double maxError = 0.;
+		float worstInput = 0.f;
+
+		Check(std::string _name, double _bound)
+			: name(_name)
+			, bound(_bound) {
+		}
+
+		void add(double error, float input) {
+			// NaN errors are failures too
+			if (!(error <= maxError)) {
+				maxError = error;
+				worstInput = input;
+			}
+		}
+
+		~Check() {
+			const auto passed = maxError <= bound;
+			printf("%-8s %-24s max error %.3g at %.9g (bound %.3g)\n", passed ? "ok" : "FAILED", name.c_str(), maxError, worstInput, bound);
+			if (!passed) {
+				++failures;
+			}
+		}
+	};
+
+	double relativeError(double value, double expected) {
+		return std::abs(value - expected) / std::abs(expected);
+	}
+
+	//! Calls f on groups of 4 inputs spread over [begin, end], the last group is padded with end
+	void sweep(double begin, double end, int count, const std::function<void(const float*)>& f) {
+		alignas(16) float x[4];
+		for (int i = 0; i < count; i += 4) {
+			for (int lane = 0; lane < 4; ++lane) {
+				const auto t = std::min(i + lane, count - 1) / (double)(count - 1);
+				x[lane] = (float)(begin + (end - begin) * t);
+			}
+			f(x);
+		}
+	}
+
+	//! sweep() over [2^beginExponent, 2^endExponent] with a constant ratio between inputs
+	void sweepExponential(double beginExponent, double endExponent, int count, const std::function<void(const float*)>& f) {
+		sweep(beginExponent, endExponent, count, [&](const float* exponents) {
+			alignas(16) float x[4];
+			for (int lane = 0; lane < 4; ++lane) {
+				x[lane] = (float)std::exp2((double)exponents[lane]);
+			}
+			f(x);
+		});
+	}
+
+	void testExp2() {
+		Check scalar("exp2", 3e-7);
+		Check batched("exp2 batched", 3e-7);
+		sweep(fastmath::minExp2, fastmath::maxExp2, 1 << 20, [&](const float* x) {
+			alignas(16) float out[4];
+			fastmath::exp2(x, out);
+			for (int i = 0; i < 4; ++i) {
+				const auto expected = std::exp2((double)x[i]);
+				scalar.add(relativeError(fastmath::exp2(x[i]), expected), x[i]);
+				batched.add(relativeError(out[i], expected), x[i]);
+			}
+		});
+	}
+
+	void testLog2() {
+		Check scalarNear("log2 [0.5, 2]", 1.2e-7);
+		Check batchedNear("log2 batched [0.5, 2]", 1.2e-7);
+		sweep(.5, 2., 1 << 20, [&](const float* x) {
+			alignas(16) float out[4];
+			fastmath::log2(x, out);
+			for (int i = 0; i < 4; ++i) {
+				const auto expected = std::log2((double)x[i]);
+				scalarNear.add(std::abs(fastmath::log2(x[i]) - expected), x[i]);
+				batchedNear.add(std::abs(out[i] - expected), x[i]);
+			}
+		});
+
+		Check scalarFar("log2", 1e-7);
+		Check batchedFar("log2 batched", 1e-7);
+		sweepExponential(-126., 127., 1 << 21, [&](const float* x) {
+			alignas(16) float out[4];
+			fastmath::log2(x, out);
+			for (int i = 0; i < 4; ++i) {
+				if (x[i] >= .5f && x[i] <= 2.f) {
+					continue;
+				}
+				const auto expected = std::log2((double)x[i]);
+				scalarFar.add(relativeError(fastmath::log2(x[i]), expected), x[i]);
+				batchedFar.add(relativeError(out[i], expected), x[i]);
+			}
+		});
+	}
+
+	void testPow() {
+		// Specular exponents, and the fractional ones used for gamma
+		const float exponents[] = { .4545f, 1.f, 2.f, 2.2f, 5.f, 8.f, 16.f, 32.f, 64.f, 128.f };
+		for (auto exponent : exponents) {
+			// Error relative to the bound of each input, so that 1 is the documented limit
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), " ^%g", exponent);
+			Check scalar(std::string("pow") + suffix, 1.);
+			Check batched(std::string("pow batched") + suffix, 1.);
+			sweepExponential(-16., 2., 1 << 18, [&](const float* x) {
+				alignas(16) float out[4];
+				fastmath::pow(x, exponent, out);
+				for (int i = 0; i < 4; ++i) {
+					const auto expected = std::pow((double)x[i], (double)exponent);
+					// Results outside of [2^-126, 2^127] are clamped, see fastmath::exp2()
+					if (expected < std::exp2((double)fastmath::minExp2) || expected > std::exp2((double)fastmath::maxExp2)) {
+						continue;
+					}
+					const auto bound = 3e-7 + 1e-7 * exponent * std::max(std::abs(std::log2((double)x[i])), 1.);
+					scalar.add(relativeError(fastmath::pow(x[i], exponent), expected) / bound, x[i]);
+					batched.add(relativeError(out[i], expected) / bound, x[i]);
+				}
+			});
+		}
+
+		Check zero("pow of 0", 0.);
+		alignas(16) const float x[4] = { 0.f, -0.f, -1.f, 0.f };
+		alignas(16) float out[4];
+		fastmath::pow(x, 8.f, out);
+		for (int i = 0; i < 4; ++i) {
+			zero.add(std::abs(fastmath::pow(x[i], 8.f)), x[i]);
+			zero.add(std::abs(out[i]), x[i]);
+		}
+	}
+
+	void testSaturate() {
+		Check scalar("saturate", 0.);
+		Check batched("saturate batched", 0.);
+		sweep(-2., 3., 1 << 16, [&](const float* x) {
+			alignas(16) float out[4];
+			fastmath::saturate(x, out);
+			for (int i = 0; i < 4; ++i) {
+				const auto expected = std::min(std::max(x[i], 0.f), 1.f);
+				scalar.add(std::abs(fastmath::saturate(x[i]) - expected), x[i]);
+				batched.add(std::abs(out[i] - expected), x[i]);
+			}
+		});
+
+		const auto nan = std::numeric_limits<float>::quiet_NaN();
+		const auto infinity = std::numeric_limits<float>::infinity();
+		alignas(16) const float special[4] = { nan, infinity, -infinity, -0.f };
+		alignas(16) const float expected[4] = { 0.f, 1.f, 0.f, 0.f };
+		alignas(16) float out[4];
+		fastmath::saturate(special, out);
+		for (int i = 0; i < 4; ++i) {
+			scalar.add(std::abs(fastmath::saturate(special[i]) - expected[i]), special[i]);
+			batched.add(std::abs(out[i] - expected[i]), special[i]);
+		}
+	}
+
+	void testNormalize() {
+		Check components("normalize", 5e-7);
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> coordinate(-1.f, 1.f);
+		std::uniform_real_distribution<float> scaleExponent(-12.f, 12.f);
+		for (int n = 0; n < (1 << 18); ++n) {
+			alignas(16) float x[4];
+			alignas(16) float y[4];
+			alignas(16) float z[4];
+			double expected[4][3];
+			for (int i = 0; i < 4; ++i) {
+				const auto scale = std::exp2(scaleExponent(random));
+				x[i] = coordinate(random) * scale;
+				y[i] = coordinate(random) * scale;
+				z[i] = coordinate(random) * scale;
+				const auto length = std::sqrt((double)x[i] * x[i] + (double)y[i] * y[i] + (double)z[i] * z[i]);
+				expected[i][0] = x[i] / length;
+				expected[i][1] = y[i] / length;
+				expected[i][2] = z[i] / length;
+			}
+			fastmath::normalize(x, y, z);
+			for (int i = 0; i < 4; ++i) {
+				components.add(std::abs(x[i] - expected[i][0]), x[i]);
+				components.add(std::abs(y[i] - expected[i][1]), y[i]);
+				components.add(std::abs(z[i] - expected[i][2]), z[i]);
+			}
+		}
+
+		Check zero("normalize of 0", 0.);
+		alignas(16) float x[4] = { 0.f, 0.f, 0.f, 0.f };
+		alignas(16) float y[4] = { 0.f, 0.f, 0.f, 0.f };
+		alignas(16) float z[4] = { 0.f, 0.f, 0.f, 0.f };
+		fastmath::normalize(x, y, z);
+		for (int i = 0; i < 4; ++i) {
+			zero.add(std::abs(x[i]) + std::abs(y[i]) + std::abs(z[i]), 0.f);
+		}
+	}
+}
+
+int main() {
+#ifdef PLATZ_FAST_MATH_SSE2
+	printf("Batched functions use SSE2\n");
+#else
+	printf("Batched functions use the scalar fallback\n");
+#endif
+	testExp2();
+	testLog2();
+	testPow();
+	testSaturate();
+	testNormalize();
+	printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+	return failures ? 1 : 0;
+}